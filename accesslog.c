@@ -0,0 +1,385 @@
+/*
+ * accesslog.c
+ *
+ * This file contains the module 'accesslog'. Requests are logged in the
+ * Common Log Format, followed by the latency in microseconds. The event loop
+ * only copies fixed-size records into a single-producer, single-consumer
+ * ring buffer; a writer thread formats them and appends them to the log in
+ * batches, so disk writes never hold up the event loop. If the writer falls
+ * behind and the ring buffer is full, records are dropped.
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#include "base.h"
+#include "accesslog.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+/**************************** Local constants ********************************/
+
+/* number of records in the ring buffer (power of two) */
+#define ALOG_RING_SIZE 4096
+
+/* longer methods and paths are cut short */
+#define ALOG_MAX_METHOD 16
+#define ALOG_MAX_PATH 192
+
+/* size of the writer's output buffer, and the longest line it formats */
+#define ALOG_BUFFER_SIZE 65536
+#define ALOG_MAX_LINE (4 * ALOG_MAX_PATH + 256)
+
+/**************************** Local types ************************************/
+
+/*
+ * a logged request, as copied into the ring buffer
+ */
+struct _alog_record
+{
+	time_t time;
+	uint64_t bytes;
+	uint64_t latency;
+	uint32_t clientAddr;
+	short status;
+	unsigned char versionMajor;
+	unsigned char versionMinor;
+	unsigned char methodLen; /* 0 if the request was malformed */
+	BOOL truncated; /* the path has been cut short */
+	unsigned short pathLen;
+	char method[ALOG_MAX_METHOD];
+	char path[ALOG_MAX_PATH];
+};
+
+/*
+ * a position in the ring buffer, on a cache line of its own so the
+ * producer and the writer do not slow each other down
+ */
+struct _alog_index
+{
+	size_t value;
+} __attribute__((aligned(64)));
+
+/**************************** Prototypes *************************************/
+
+void* _alog_writer(void* arg);
+void _alog_wait(void);
+void _alog_wake(void);
+BOOL _alog_drain(void);
+size_t _alog_format(char* buf, const struct _alog_record* record);
+size_t _alog_escape(char* buf, const char* str, size_t len);
+void _alog_flush(const char* buf, size_t len);
+
+/**************************** Global constants *******************************/
+
+const int ALOG_OK = 0;
+const int ALOG_ERROR = 1;
+
+/**************************** Local variables ********************************/
+
+/* the log file, or -1 */
+int _alog_fd = -1;
+
+/* the ring buffer. Records from head up to tail are waiting to be written;
+ * the producer only moves tail, the writer only moves head. */
+struct _alog_record _alog_ring[ALOG_RING_SIZE];
+struct _alog_index _alog_head;
+struct _alog_index _alog_tail;
+
+/* the writer thread, whether it is running and whether it should stop */
+pthread_t _alog_thread;
+BOOL _alog_running;
+BOOL _alog_stop;
+
+/* the writer blocks on this eventfd while the ring buffer is empty, after
+ * setting _alog_sleeping, which tells the producer to signal it */
+int _alog_event_fd = -1;
+BOOL _alog_sleeping;
+
+/* the second of the last timestamp formatted, and its text (writer only) */
+time_t _alog_last_time = -1;
+char _alog_time_text[32];
+
+/**************************** Module interface *******************************/
+
+int alog_open(const char* file)
+{
+	_alog_fd = open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if(_alog_fd < 0)
+		return ALOG_ERROR;
+
+	// Read the time zone once, before there are threads
+	tzset();
+	return ALOG_OK;
+}
+
+int alog_start(void)
+{
+	if(_alog_fd < 0)
+		return ALOG_OK;
+
+	_alog_stop = FALSE;
+	_alog_sleeping = FALSE;
+	_alog_event_fd = eventfd(0, EFD_CLOEXEC);
+	if(_alog_event_fd < 0)
+		return ALOG_ERROR;
+
+	// Signals are to be handled by the event loop; the writer inherits the
+	// mask of its creator, so block all of them around its creation.
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	int ret = pthread_create(&_alog_thread, NULL, _alog_writer, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if(ret != 0)
+	{
+		close(_alog_event_fd);
+		_alog_event_fd = -1;
+		return ALOG_ERROR;
+	}
+	_alog_running = TRUE;
+	return ALOG_OK;
+}
+
+BOOL alog_write(const struct alog_entry* entry)
+{
+	if(_alog_running != TRUE)
+		return TRUE;
+
+	size_t tail = _alog_tail.value;
+	if(tail - __atomic_load_n(&_alog_head.value, __ATOMIC_ACQUIRE) == ALOG_RING_SIZE)
+		return FALSE;
+
+	struct _alog_record* record = &_alog_ring[tail & (ALOG_RING_SIZE - 1)];
+	record->time = time(NULL);
+	record->bytes = entry->bytes;
+	record->latency = entry->latency;
+	record->clientAddr = entry->clientAddr;
+	record->status = entry->status;
+	record->versionMajor = entry->versionMajor;
+	record->versionMinor = entry->versionMinor;
+
+	if(entry->method != NULL)
+	{
+		record->methodLen = (entry->methodLen < ALOG_MAX_METHOD) ? entry->methodLen : ALOG_MAX_METHOD;
+		memcpy(record->method, entry->method, record->methodLen);
+		record->pathLen = (entry->pathLen < ALOG_MAX_PATH) ? entry->pathLen : ALOG_MAX_PATH;
+		memcpy(record->path, entry->path, record->pathLen);
+		record->truncated = (entry->pathLen > ALOG_MAX_PATH) ? TRUE : FALSE;
+	}
+	else
+	{
+		record->methodLen = 0;
+	}
+
+	// Publish the record to the writer, and wake it if it has gone to
+	// sleep on an empty ring buffer. Either it sees the record when it
+	// looks again, or we see it sleeping (both sides use sequential
+	// consistency for this).
+	__atomic_store_n(&_alog_tail.value, tail + 1, __ATOMIC_SEQ_CST);
+	if((__atomic_load_n(&_alog_sleeping, __ATOMIC_SEQ_CST) == TRUE) &&
+		(__atomic_exchange_n(&_alog_sleeping, FALSE, __ATOMIC_SEQ_CST) == TRUE))
+		_alog_wake();
+	return TRUE;
+}
+
+void alog_clean_up(void)
+{
+	if(_alog_running == TRUE)
+	{
+		__atomic_store_n(&_alog_stop, TRUE, __ATOMIC_RELEASE);
+		_alog_wake();
+		pthread_join(_alog_thread, NULL);
+		_alog_running = FALSE;
+	}
+
+	if(_alog_event_fd >= 0)
+		close(_alog_event_fd);
+	_alog_event_fd = -1;
+
+	if(_alog_fd >= 0)
+		close(_alog_fd);
+	_alog_fd = -1;
+}
+
+/**************************** Local methods **********************************/
+
+/*
+ * The writer thread. Writes what is in the ring buffer and blocks whenever
+ * it is empty, until the producer wakes it. When asked to stop, it empties
+ * it once more.
+ */
+void* _alog_writer(void* arg)
+{
+	while(TRUE)
+	{
+		// Records written before the stop request are seen by this drain
+		BOOL stop = __atomic_load_n(&_alog_stop, __ATOMIC_ACQUIRE);
+		if(_alog_drain() == TRUE)
+			continue;
+		if(stop == TRUE)
+			break;
+		_alog_wait();
+	}
+
+	return NULL;
+}
+
+/*
+ * Blocks the writer until it is woken, unless records have arrived since
+ * the ring buffer was found empty. A wake-up that is not needed any more
+ * only makes the writer look once more.
+ */
+void _alog_wait(void)
+{
+	__atomic_store_n(&_alog_sleeping, TRUE, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&_alog_tail.value, __ATOMIC_SEQ_CST) == _alog_head.value)
+	{
+		uint64_t count;
+		while((read(_alog_event_fd, &count, sizeof(count)) < 0) && (errno == EINTR))
+			;
+	}
+	__atomic_store_n(&_alog_sleeping, FALSE, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Wakes the writer if it is blocked, or makes it skip its next wait.
+ */
+void _alog_wake(void)
+{
+	uint64_t one = 1;
+	while((write(_alog_event_fd, &one, sizeof(one)) < 0) && (errno == EINTR))
+		;
+}
+
+/*
+ * Formats and writes the records in the ring buffer. Returns FALSE if it
+ * was empty.
+ */
+BOOL _alog_drain(void)
+{
+	static char buf[ALOG_BUFFER_SIZE];
+
+	size_t head = _alog_head.value;
+	size_t tail = __atomic_load_n(&_alog_tail.value, __ATOMIC_ACQUIRE);
+	if(head == tail)
+		return FALSE;
+
+	size_t len = 0;
+	for(; head != tail; ++head)
+	{
+		if(len + ALOG_MAX_LINE > ALOG_BUFFER_SIZE)
+		{
+			_alog_flush(buf, len);
+			len = 0;
+		}
+		len += _alog_format(&buf[len], &_alog_ring[head & (ALOG_RING_SIZE - 1)]);
+
+		// Hand the slot back at once, the record has been copied
+		__atomic_store_n(&_alog_head.value, head + 1, __ATOMIC_RELEASE);
+	}
+
+	_alog_flush(buf, len);
+	return TRUE;
+}
+
+/*
+ * Formats a record as a line of the log. 'buf' must have room for
+ * ALOG_MAX_LINE bytes. Returns the length of the line.
+ */
+size_t _alog_format(char* buf, const struct _alog_record* record)
+{
+	if(record->time != _alog_last_time)
+	{
+		struct tm tm;
+		localtime_r(&record->time, &tm);
+		strftime(_alog_time_text, sizeof(_alog_time_text), "%d/%b/%Y:%H:%M:%S %z", &tm);
+		_alog_last_time = record->time;
+	}
+
+	const unsigned char* addr = (const unsigned char*) &record->clientAddr;
+	size_t len = sprintf(buf, "%u.%u.%u.%u - - [%s] \"", addr[0], addr[1], addr[2], addr[3], _alog_time_text);
+
+	if(record->methodLen > 0)
+	{
+		len += _alog_escape(&buf[len], record->method, record->methodLen);
+		buf[len++] = ' ';
+		len += _alog_escape(&buf[len], record->path, record->pathLen);
+		if(record->truncated == TRUE)
+			len += sprintf(&buf[len], "...");
+		len += sprintf(&buf[len], " HTTP/%u.%u\"", record->versionMajor, record->versionMinor);
+	}
+	else
+	{
+		len += sprintf(&buf[len], "-\"");
+	}
+
+	len += sprintf(&buf[len], " %d ", record->status);
+	if(record->bytes > 0)
+		len += sprintf(&buf[len], "%llu", (unsigned long long) record->bytes);
+	else
+		buf[len++] = '-';
+	len += sprintf(&buf[len], " %llu\n", (unsigned long long) record->latency);
+	return len;
+}
+
+/*
+ * Copies 'str' of length 'len' to 'buf', replacing quotes, backslashes and
+ * non-printable characters by "\xHH". Returns the number of bytes written.
+ */
+size_t _alog_escape(char* buf, const char* str, size_t len)
+{
+	static const char hex[] = "0123456789ABCDEF";
+
+	size_t out = 0;
+	size_t i;
+	for(i = 0; i < len; ++i)
+	{
+		unsigned char c = str[i];
+		if((c < 0x20) || (c >= 0x7f) || (c == '"') || (c == '\\'))
+		{
+			buf[out++] = '\\';
+			buf[out++] = 'x';
+			buf[out++] = hex[c >> 4];
+			buf[out++] = hex[c & 0xf];
+		}
+		else
+		{
+			buf[out++] = c;
+		}
+	}
+	return out;
+}
+
+/*
+ * Appends 'len' bytes to the log. The file is opened for appending, so
+ * the writes of several workers do not overwrite each other.
+ */
+void _alog_flush(const char* buf, size_t len)
+{
+	while(len > 0)
+	{
+		ssize_t written = write(_alog_fd, buf, len);
+		if(written < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			fprintf(stderr, "Error: Could not write access log.\n");
+			return;
+		}
+		buf += written;
+		len -= written;
+	}
+}
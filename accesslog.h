@@ -0,0 +1,75 @@
+/*
+ * accesslog.h
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#ifndef ACCESSLOG_H_
+#define ACCESSLOG_H_
+
+#include "base.h"
+
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint32_t, uint64_t
+
+/**************************** Module types & constants ***********************/
+
+/*
+ * A request to be logged. The strings need not be terminated and are only
+ * read during alog_write().
+ */
+struct alog_entry
+{
+	uint32_t clientAddr; /* IPv4 address of the client, network byte order */
+	const char* method; /* request method, NULL if the request was malformed */
+	size_t methodLen;
+	const char* path; /* request target */
+	size_t pathLen;
+	int versionMajor; /* HTTP version */
+	int versionMinor;
+	int status; /* status code of the response */
+	uint64_t bytes; /* length of the response body */
+	uint64_t latency; /* time from reading the request to queueing the response in microseconds */
+};
+
+/*
+ * returned by alog_open() and alog_start().
+ */
+extern const int ALOG_OK;
+extern const int ALOG_ERROR;
+
+/**************************** Module interface *******************************/
+
+/*
+ * Opens the access log 'file' for appending, creating it if necessary. Has
+ * to be called before the workers are started, which share the file.
+ * Returns ALOG_OK or ALOG_ERROR.
+ */
+int alog_open(const char* file);
+
+/*
+ * Starts the thread writing the access log of the calling process. Has to be
+ * called in each worker after it has been started; nothing is logged before.
+ * Returns ALOG_OK, or ALOG_ERROR if the thread could not be created.
+ */
+int alog_start(void);
+
+/*
+ * Logs a request. The entry is copied into a ring buffer (a long path is cut
+ * short) which the writer thread empties in batches, so this never blocks;
+ * it only calls into the kernel to wake the writer when that is idle. Must
+ * only be called from the thread which called alog_start().
+ * Returns FALSE if the ring buffer was full and the entry has been dropped,
+ * TRUE otherwise (also if no log is written).
+ */
+BOOL alog_write(const struct alog_entry* entry);
+
+/*
+ * Clean-up method. Has to be called when the server exits; writes the
+ * entries still buffered, stops the writer thread and closes the log.
+ */
+void alog_clean_up(void);
+
+#endif /* ACCESSLOG_H_ */
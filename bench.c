@@ -0,0 +1,867 @@
+/*
+ * bench.c
+ *
+ * A HTTP load generator for measuring cwebserver (built by 'make bench').
+ * Every thread drives its share of the connections from its own epoll
+ * loop, either closed loop (a connection sends its next request as soon as
+ * the previous response is complete) or open loop (requests are issued at
+ * a fixed total rate, and latency is measured from the time a request was
+ * due, so a stalling server cannot hide behind the generator waiting).
+ * Requests either pick from a weighted set of paths (to get a mix of file
+ * sizes) or replay the paths of a file in order.
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#include "base.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/**************************** Types ******************************************/
+
+/*
+ * a path requested by the load generator, with its serialized request
+ */
+struct target
+{
+	char* path;
+	int weight; /* relative frequency (weighted mode) */
+	char* request;
+	size_t requestLen;
+};
+
+/*
+ * a latency histogram in microseconds with log-linear buckets: values
+ * below 64 have their own bucket, above that every power of two is split
+ * into 64 buckets (an error of less than 2%)
+ */
+#define HIST_SUB_BUCKETS 64
+#define HIST_BUCKETS (HIST_SUB_BUCKETS * 36)
+struct histogram
+{
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t total;
+	uint64_t max;
+};
+
+/*
+ * a client connection and the request it is working on
+ */
+struct connection
+{
+	int fd; /* -1 if not connected */
+	int state;
+	BOOL reused; /* has carried a complete response before */
+	struct target* target;
+	size_t sent; /* bytes of the request sent */
+	uint64_t start; /* when the request was issued (or was due), in ns */
+	uint64_t due; /* open loop: when the next request is due, in ns */
+
+	char head[4096]; /* response header */
+	size_t headLen;
+	int status;
+	long long bodyLeft; /* -1 while the header is incomplete */
+	BOOL closeAfter; /* the server closes the connection after this response */
+	uint64_t received; /* bytes of this response */
+};
+
+/*
+ * the state and results of a load generating thread
+ */
+struct thread
+{
+	pthread_t handle;
+	int id;
+	int epollFd;
+	struct connection* conns;
+	int numConns;
+	unsigned int random;
+	size_t replayPos;
+
+	struct histogram latency;
+	uint64_t requests;
+	uint64_t errors;
+	uint64_t bytes;
+	uint64_t statusClasses[6]; /* by first digit, [0] for anything else */
+};
+
+/**************************** Prototypes *************************************/
+
+void print_usage(void);
+BOOL add_target(const char* spec);
+BOOL append_target(char* path, int weight);
+BOOL load_replay_file(const char* file);
+BOOL prepare_targets(void);
+void* run_thread(void* arg);
+void issue_request(struct thread* thread, struct connection* conn, uint64_t start);
+BOOL start_connect(struct thread* thread, struct connection* conn);
+void handle_event(struct thread* thread, struct connection* conn, uint32_t events);
+BOOL send_request(struct thread* thread, struct connection* conn);
+BOOL receive_response(struct thread* thread, struct connection* conn);
+BOOL parse_header(struct connection* conn);
+void complete_request(struct thread* thread, struct connection* conn);
+void fail_request(struct thread* thread, struct connection* conn);
+void close_connection(struct thread* thread, struct connection* conn);
+BOOL set_events(struct thread* thread, struct connection* conn, uint32_t events, int op);
+struct target* pick_target(struct thread* thread);
+uint64_t now_ns(void);
+void hist_record(struct histogram* hist, uint64_t value);
+void hist_merge(struct histogram* into, const struct histogram* from);
+uint64_t hist_percentile(const struct histogram* hist, double percentile);
+void on_sigint(int sig);
+
+/**************************** Constants **************************************/
+
+/* connection states */
+#define STATE_IDLE 0
+#define STATE_CONNECTING 1
+#define STATE_SENDING 2
+#define STATE_RECEIVING 3
+
+/* longest time the event loop sleeps, so the end of the run is noticed */
+#define MAX_WAIT_MS 50
+
+/* events fetched by one epoll_wait() */
+#define MAX_EVENTS 256
+
+/* size of the buffer response bodies are read into (and dropped) */
+#define READ_BUFFER_SIZE (64 * 1024)
+
+/**************************** Configuration **********************************/
+
+struct sockaddr_in serverAddr;
+int numThreads = 1;
+int numConnections = 16;
+int duration = 10;
+BOOL keepAlive;
+double rate; /* requests per second over all connections, 0 for closed loop */
+
+/* the paths to request and the sum of their weights */
+struct target* targets;
+int numTargets;
+int totalWeight;
+
+/* whether 'targets' are replayed in order instead of picked by weight */
+BOOL replay;
+
+/* set when the run is over */
+volatile sig_atomic_t stopRun;
+
+/* when the run started, in ns */
+uint64_t runStart;
+
+/**************************** Main *******************************************/
+
+int main(int argc, char* argv[])
+{
+	memset(&serverAddr, 0, sizeof(struct sockaddr_in));
+	serverAddr.sin_family = AF_INET;
+	serverAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	int opt;
+	while((opt = getopt(argc, argv, "a:t:c:d:kr:p:f:")) != -1)
+	{
+		if(opt == 'a')
+		{
+			if(inet_pton(AF_INET, optarg, &serverAddr.sin_addr) != 1)
+			{
+				fprintf(stderr, "Error: Invalid address %s.\n", optarg);
+				return 1;
+			}
+		}
+		else if(opt == 't')
+		{
+			numThreads = atoi(optarg);
+		}
+		else if(opt == 'c')
+		{
+			numConnections = atoi(optarg);
+		}
+		else if(opt == 'd')
+		{
+			duration = atoi(optarg);
+		}
+		else if(opt == 'k')
+		{
+			keepAlive = TRUE;
+		}
+		else if(opt == 'r')
+		{
+			rate = atof(optarg);
+		}
+		else if(opt == 'p')
+		{
+			if((replay == TRUE) || (add_target(optarg) == FALSE))
+			{
+				print_usage();
+				return 1;
+			}
+		}
+		else if(opt == 'f')
+		{
+			if((numTargets > 0) || (load_replay_file(optarg) == FALSE))
+			{
+				fprintf(stderr, "Error: Could not read requests from %s.\n", optarg);
+				return 1;
+			}
+		}
+		else
+		{
+			print_usage();
+			return 1;
+		}
+	}
+
+	if((argc - optind != 1) || (numThreads < 1) || (numConnections < numThreads) ||
+		(duration < 1) || (rate < 0))
+	{
+		print_usage();
+		return 1;
+	}
+
+	int port = atoi(argv[optind]);
+	if((port < 1) || (port > 65535))
+	{
+		print_usage();
+		return 1;
+	}
+	serverAddr.sin_port = htons(port);
+
+	if((numTargets == 0) && (add_target("/index.html") == FALSE))
+		return 1;
+	if(prepare_targets() == FALSE)
+		return 1;
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, on_sigint);
+
+	char addr[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &serverAddr.sin_addr, addr, sizeof(addr));
+	printf("Running %d s test @ %s:%d: %d threads, %d connections, %s, ", duration, addr, port,
+			numThreads, numConnections, (keepAlive == TRUE) ? "keep-alive" : "one request per connection");
+	if(rate > 0)
+		printf("open loop at %.0f requests/s\n", rate);
+	else
+		printf("closed loop\n");
+
+	// Start the threads, each with its share of the connections
+	struct thread* threads = calloc(numThreads, sizeof(struct thread));
+	if(threads == NULL)
+		return 1;
+
+	runStart = now_ns();
+	int i;
+	for(i = 0; i < numThreads; ++i)
+	{
+		threads[i].id = i;
+		threads[i].numConns = numConnections / numThreads + ((i < numConnections % numThreads) ? 1 : 0);
+		threads[i].random = 2463534242u + i;
+		threads[i].replayPos = i;
+		if(pthread_create(&threads[i].handle, NULL, run_thread, &threads[i]) != 0)
+		{
+			fprintf(stderr, "Error: Could not start thread.\n");
+			return 1;
+		}
+	}
+
+	// Let them run
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += duration;
+	while((stopRun == 0) &&
+		(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &end, NULL) == EINTR))
+		;
+	stopRun = 1;
+
+	// Sum up the results
+	struct histogram* latency = calloc(1, sizeof(struct histogram));
+	if(latency == NULL)
+		return 1;
+	uint64_t requests = 0, errors = 0, bytes = 0;
+	uint64_t statusClasses[6] = { 0, 0, 0, 0, 0, 0 };
+	for(i = 0; i < numThreads; ++i)
+	{
+		pthread_join(threads[i].handle, NULL);
+		hist_merge(latency, &threads[i].latency);
+		requests += threads[i].requests;
+		errors += threads[i].errors;
+		bytes += threads[i].bytes;
+		int j;
+		for(j = 0; j < 6; ++j)
+			statusClasses[j] += threads[i].statusClasses[j];
+	}
+	double seconds = (now_ns() - runStart) / 1e9;
+
+	printf("  requests:   %llu (%.1f/s)\n", (unsigned long long) requests, requests / seconds);
+	printf("  transfer:   %.1f MB (%.1f MB/s)\n", bytes / 1e6, bytes / 1e6 / seconds);
+	printf("  errors:     %llu\n", (unsigned long long) errors);
+	printf("  status:     2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, other %llu\n",
+			(unsigned long long) statusClasses[2], (unsigned long long) statusClasses[3],
+			(unsigned long long) statusClasses[4], (unsigned long long) statusClasses[5],
+			(unsigned long long) (statusClasses[0] + statusClasses[1]));
+	if(latency->total > 0)
+	{
+		printf("  latency:    p50 %llu us, p99 %llu us, p99.9 %llu us, max %llu us\n",
+				(unsigned long long) hist_percentile(latency, 50.0),
+				(unsigned long long) hist_percentile(latency, 99.0),
+				(unsigned long long) hist_percentile(latency, 99.9),
+				(unsigned long long) latency->max);
+	}
+
+	free(latency);
+	free(threads);
+	return (requests > 0) ? 0 : 1;
+}
+
+/**************************** Setup ******************************************/
+
+void print_usage(void)
+{
+	printf("Usage:\n");
+	printf("\tcwebbench [-a address] [-t threads] [-c connections] [-d seconds] [-k] [-r rate]\n");
+	printf("\t          [-p path[:weight]]... [-f file] port\n");
+	printf("\t-a address\tIPv4 address of the server (default 127.0.0.1)\n");
+	printf("\t-t threads\tnumber of threads (default 1)\n");
+	printf("\t-c connections\tnumber of connections over all threads (default 16)\n");
+	printf("\t-d seconds\tduration of the run (default 10)\n");
+	printf("\t-k\t\tkeep connections alive instead of one request per connection\n");
+	printf("\t-r rate\t\topen loop: issue this many requests per second in total\n");
+	printf("\t-p path[:weight]\trequest 'path' (repeatable, picked at random by weight)\n");
+	printf("\t-f file\t\treplay the paths listed in 'file' (one per line) in order\n");
+}
+
+/*
+ * Adds a path to request, given as 'path' or 'path:weight'.
+ */
+BOOL add_target(const char* spec)
+{
+	char* path = strdup(spec);
+	if(path == NULL)
+		return FALSE;
+
+	int weight = 1;
+	char* colon = strrchr(path, ':');
+	if(colon != NULL)
+	{
+		*colon = '\0';
+		weight = atoi(colon + 1);
+	}
+
+	if((path[0] != '/') || (weight < 1) || (append_target(path, weight) == FALSE))
+	{
+		free(path);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Appends a target for the (allocated) 'path'.
+ */
+BOOL append_target(char* path, int weight)
+{
+	struct target* grown = realloc(targets, (numTargets + 1) * sizeof(struct target));
+	if(grown == NULL)
+		return FALSE;
+	targets = grown;
+
+	struct target* target = &targets[numTargets++];
+	memset(target, 0, sizeof(struct target));
+	target->path = path;
+	target->weight = weight;
+	totalWeight += weight;
+	return TRUE;
+}
+
+/*
+ * Reads the paths to replay from 'file', one per line. Empty lines and
+ * lines starting with '#' are skipped.
+ */
+BOOL load_replay_file(const char* file)
+{
+	FILE* f = fopen(file, "r");
+	if(f == NULL)
+		return FALSE;
+
+	char* line = NULL;
+	size_t lineSize = 0;
+	ssize_t len;
+	BOOL ok = TRUE;
+	while((ok == TRUE) && ((len = getline(&line, &lineSize, f)) != -1))
+	{
+		while((len > 0) && ((line[len - 1] == '\n') || (line[len - 1] == '\r')))
+			line[--len] = '\0';
+		if((len == 0) || (line[0] == '#'))
+			continue;
+
+		// Unlike with -p, paths may contain colons here
+		char* path = strdup(line);
+		ok = (path != NULL) && (append_target(path, 1) == TRUE);
+	}
+
+	free(line);
+	fclose(f);
+	replay = TRUE;
+	return (ok == TRUE) && (numTargets > 0);
+}
+
+/*
+ * Serializes the request of every target.
+ */
+BOOL prepare_targets(void)
+{
+	int i;
+	for(i = 0; i < numTargets; ++i)
+	{
+		struct target* target = &targets[i];
+		size_t size = strlen(target->path) + 128;
+		target->request = malloc(size);
+		if(target->request == NULL)
+			return FALSE;
+		target->requestLen = snprintf(target->request, size,
+				"GET %s HTTP/1.1\r\nHost: localhost\r\n%s\r\n", target->path,
+				(keepAlive == TRUE) ? "" : "Connection: close\r\n");
+	}
+	return TRUE;
+}
+
+/**************************** Load generation ********************************/
+
+/*
+ * The event loop of a thread.
+ */
+void* run_thread(void* arg)
+{
+	struct thread* thread = arg;
+	struct epoll_event events[MAX_EVENTS];
+
+	thread->epollFd = epoll_create1(EPOLL_CLOEXEC);
+	thread->conns = calloc(thread->numConns, sizeof(struct connection));
+	if((thread->epollFd < 0) || (thread->conns == NULL))
+	{
+		fprintf(stderr, "Error: Could not set up thread %d.\n", thread->id);
+		return NULL;
+	}
+
+	// Spread the first requests of the open loop evenly over one interval
+	uint64_t interval = (rate > 0) ? (uint64_t) (numConnections / rate * 1e9) : 0;
+	int i;
+	for(i = 0; i < thread->numConns; ++i)
+	{
+		struct connection* conn = &thread->conns[i];
+		conn->fd = -1;
+		conn->due = runStart + interval * (i * numThreads + thread->id) / numConnections;
+	}
+
+	while(stopRun == 0)
+	{
+		// Issue the requests which are due
+		uint64_t now = now_ns();
+		int timeout = MAX_WAIT_MS;
+		for(i = 0; i < thread->numConns; ++i)
+		{
+			struct connection* conn = &thread->conns[i];
+			if(conn->state != STATE_IDLE)
+				continue;
+
+			if(rate <= 0)
+			{
+				issue_request(thread, conn, now);
+			}
+			else if(conn->due <= now)
+			{
+				issue_request(thread, conn, conn->due);
+				conn->due += interval;
+			}
+			else if((conn->due - now) / 1000000 < (uint64_t) timeout)
+			{
+				timeout = (conn->due - now) / 1000000;
+			}
+		}
+
+		int numEvents = epoll_wait(thread->epollFd, events, MAX_EVENTS, timeout);
+		for(i = 0; i < numEvents; ++i)
+			handle_event(thread, events[i].data.ptr, events[i].events);
+	}
+
+	for(i = 0; i < thread->numConns; ++i)
+	{
+		if(thread->conns[i].fd >= 0)
+			close(thread->conns[i].fd);
+	}
+	close(thread->epollFd);
+	free(thread->conns);
+	return NULL;
+}
+
+/*
+ * Starts a request on an idle connection, connecting first if necessary.
+ * 'start' is the time its latency is measured from.
+ */
+void issue_request(struct thread* thread, struct connection* conn, uint64_t start)
+{
+	conn->target = pick_target(thread);
+	conn->start = start;
+	conn->sent = 0;
+	conn->headLen = 0;
+	conn->bodyLeft = -1;
+	conn->status = 0;
+	conn->closeAfter = FALSE;
+	conn->received = 0;
+
+	if(conn->fd < 0)
+	{
+		if(start_connect(thread, conn) == FALSE)
+			fail_request(thread, conn);
+		return;
+	}
+
+	conn->state = STATE_SENDING;
+	if(send_request(thread, conn) == FALSE)
+		fail_request(thread, conn);
+}
+
+/*
+ * Opens a non-blocking connection to the server.
+ */
+BOOL start_connect(struct thread* thread, struct connection* conn)
+{
+	conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(conn->fd < 0)
+		return FALSE;
+	conn->reused = FALSE;
+
+	int on = 1;
+	setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+	conn->state = STATE_CONNECTING;
+	if((connect(conn->fd, (struct sockaddr*) &serverAddr, sizeof(serverAddr)) < 0) &&
+		(errno != EINPROGRESS))
+		return FALSE;
+
+	return set_events(thread, conn, EPOLLIN | EPOLLOUT, EPOLL_CTL_ADD);
+}
+
+/*
+ * Handles readiness of a connection.
+ */
+void handle_event(struct thread* thread, struct connection* conn, uint32_t events)
+{
+	if(conn->state == STATE_CONNECTING)
+	{
+		int error = 0;
+		socklen_t len = sizeof(error);
+		if((getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) || (error != 0))
+		{
+			fail_request(thread, conn);
+			return;
+		}
+		conn->state = STATE_SENDING;
+	}
+
+	if(conn->state == STATE_SENDING)
+	{
+		if(send_request(thread, conn) == FALSE)
+			fail_request(thread, conn);
+	}
+	else if((conn->state == STATE_RECEIVING) && (events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+	{
+		if(receive_response(thread, conn) == FALSE)
+		{
+			// A kept-alive connection may have been closed by the server
+			// before it saw the request; that is not the server's fault.
+			BOOL retry = (conn->reused == TRUE) && (conn->received == 0);
+			uint64_t start = conn->start;
+			close_connection(thread, conn);
+			if(retry == TRUE)
+				issue_request(thread, conn, start);
+			else
+				++thread->errors;
+		}
+	}
+}
+
+/*
+ * Sends (the rest of) the request. Returns FALSE on failure.
+ */
+BOOL send_request(struct thread* thread, struct connection* conn)
+{
+	while(conn->sent < conn->target->requestLen)
+	{
+		ssize_t ret = send(conn->fd, &conn->target->request[conn->sent],
+				conn->target->requestLen - conn->sent, 0);
+		if(ret < 0)
+		{
+			if(errno == EAGAIN)
+				return set_events(thread, conn, EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD);
+			if(errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		conn->sent += ret;
+	}
+
+	conn->state = STATE_RECEIVING;
+	return set_events(thread, conn, EPOLLIN, EPOLL_CTL_MOD);
+}
+
+/*
+ * Reads what has arrived of the response. Returns FALSE if the connection
+ * failed or was closed before the response was complete.
+ */
+BOOL receive_response(struct thread* thread, struct connection* conn)
+{
+	char buf[READ_BUFFER_SIZE];
+
+	for(;;)
+	{
+		// The header is collected, the body only counted
+		char* dst = buf;
+		size_t size = sizeof(buf);
+		if(conn->bodyLeft < 0)
+		{
+			dst = &conn->head[conn->headLen];
+			size = sizeof(conn->head) - 1 - conn->headLen;
+			if(size == 0)
+				return FALSE;
+		}
+		else if(conn->bodyLeft < (long long) size)
+		{
+			size = conn->bodyLeft;
+		}
+
+		ssize_t ret = recv(conn->fd, dst, size, 0);
+		if(ret == 0)
+			return FALSE;
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return (errno == EAGAIN);
+		}
+		conn->received += ret;
+
+		if(conn->bodyLeft < 0)
+		{
+			conn->headLen += ret;
+			conn->head[conn->headLen] = '\0';
+			char* end = strstr(conn->head, "\r\n\r\n");
+			if(end == NULL)
+				continue;
+			if(parse_header(conn) == FALSE)
+				return FALSE;
+
+			// Part of the body may have come with the header
+			long long extra = conn->headLen - (end + 4 - conn->head);
+			conn->bodyLeft -= extra;
+		}
+		else
+		{
+			conn->bodyLeft -= ret;
+		}
+
+		if(conn->bodyLeft <= 0)
+		{
+			complete_request(thread, conn);
+			return TRUE;
+		}
+	}
+}
+
+/*
+ * Takes status, Content-Length and Connection from a complete header.
+ */
+BOOL parse_header(struct connection* conn)
+{
+	if((strncmp(conn->head, "HTTP/1.", 7) != 0) || (strlen(conn->head) < 12))
+		return FALSE;
+	conn->status = atoi(&conn->head[9]);
+	conn->bodyLeft = 0;
+
+	char* line = strstr(conn->head, "\r\n") + 2;
+	while(strncmp(line, "\r\n", 2) != 0)
+	{
+		if(strncasecmp(line, "Content-Length:", 15) == 0)
+			conn->bodyLeft = atoll(&line[15]);
+		else if((strncasecmp(line, "Connection:", 11) == 0) && (strncasecmp(&line[11], " close", 6) == 0))
+			conn->closeAfter = TRUE;
+		line = strstr(line, "\r\n") + 2;
+	}
+
+	if(strncmp(conn->head, "HTTP/1.0", 8) == 0)
+		conn->closeAfter = TRUE;
+	return TRUE;
+}
+
+/*
+ * Records a complete response and makes the connection available for the
+ * next request.
+ */
+void complete_request(struct thread* thread, struct connection* conn)
+{
+	if(stopRun == 0)
+	{
+		hist_record(&thread->latency, (now_ns() - conn->start) / 1000);
+		++thread->requests;
+		thread->bytes += conn->received;
+		int statusClass = conn->status / 100;
+		++thread->statusClasses[((statusClass >= 1) && (statusClass <= 5)) ? statusClass : 0];
+	}
+
+	if((keepAlive == FALSE) || (conn->closeAfter == TRUE))
+	{
+		close_connection(thread, conn);
+	}
+	else
+	{
+		conn->reused = TRUE;
+		conn->state = STATE_IDLE;
+	}
+}
+
+/*
+ * Counts a failed request and drops its connection.
+ */
+void fail_request(struct thread* thread, struct connection* conn)
+{
+	++thread->errors;
+	close_connection(thread, conn);
+}
+
+void close_connection(struct thread* thread, struct connection* conn)
+{
+	if(conn->fd >= 0)
+		close(conn->fd);
+	conn->fd = -1;
+	conn->state = STATE_IDLE;
+}
+
+BOOL set_events(struct thread* thread, struct connection* conn, uint32_t events, int op)
+{
+	struct epoll_event event;
+	event.events = events;
+	event.data.ptr = conn;
+	return (epoll_ctl(thread->epollFd, op, conn->fd, &event) == 0);
+}
+
+/*
+ * Returns the target of the next request: the next path of the replay
+ * list, or a random one by weight.
+ */
+struct target* pick_target(struct thread* thread)
+{
+	if(replay == TRUE)
+	{
+		struct target* target = &targets[thread->replayPos % numTargets];
+		thread->replayPos += numThreads;
+		return target;
+	}
+
+	if(numTargets == 1)
+		return &targets[0];
+
+	// xorshift32
+	thread->random ^= thread->random << 13;
+	thread->random ^= thread->random >> 17;
+	thread->random ^= thread->random << 5;
+
+	int pick = thread->random % totalWeight;
+	int i;
+	for(i = 0; pick >= targets[i].weight; ++i)
+		pick -= targets[i].weight;
+	return &targets[i];
+}
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**************************** Histogram **************************************/
+
+void hist_record(struct histogram* hist, uint64_t value)
+{
+	int index;
+	if(value < HIST_SUB_BUCKETS)
+	{
+		index = value;
+	}
+	else
+	{
+		int exponent = 63 - __builtin_clzll(value);
+		index = (exponent - 5) * HIST_SUB_BUCKETS + (int) (value >> (exponent - 6)) - HIST_SUB_BUCKETS;
+		if(index >= HIST_BUCKETS)
+			index = HIST_BUCKETS - 1;
+	}
+
+	++hist->counts[index];
+	++hist->total;
+	if(value > hist->max)
+		hist->max = value;
+}
+
+void hist_merge(struct histogram* into, const struct histogram* from)
+{
+	int i;
+	for(i = 0; i < HIST_BUCKETS; ++i)
+		into->counts[i] += from->counts[i];
+	into->total += from->total;
+	if(from->max > into->max)
+		into->max = from->max;
+}
+
+/*
+ * Returns the upper bound of the bucket holding the given percentile.
+ */
+uint64_t hist_percentile(const struct histogram* hist, double percentile)
+{
+	uint64_t rank = (uint64_t) (hist->total * percentile / 100.0);
+	if(rank >= hist->total)
+		rank = hist->total - 1;
+
+	uint64_t seen = 0;
+	int i;
+	for(i = 0; i < HIST_BUCKETS; ++i)
+	{
+		seen += hist->counts[i];
+		if(seen > rank)
+			break;
+	}
+
+	uint64_t value;
+	if(i < HIST_SUB_BUCKETS)
+	{
+		value = i;
+	}
+	else
+	{
+		int exponent = i / HIST_SUB_BUCKETS + 5;
+		uint64_t sub = i % HIST_SUB_BUCKETS + HIST_SUB_BUCKETS;
+		value = ((sub + 1) << (exponent - 6)) - 1;
+	}
+	return (value < hist->max) ? value : hist->max;
+}
+
+void on_sigint(int sig)
+{
+	stopRun = 1;
+}
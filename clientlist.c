@@ -1,7 +1,10 @@
 /*
  * clientlist.c
  *
- * This is a simple linked list to store the socket file descriptors in.
+ * This is the connection table. Connection structs live in a slab of
+ * fixed-size chunks and are found by an array indexed by socket fd, so
+ * adding, removing and looking up a connection are O(1). Free slots are
+ * kept in a free list and reused before the slab grows.
  *
  *  Created on: 09.01.2010
  *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
@@ -11,143 +14,200 @@
 #include "clientlist.h"
 
 #include <stdlib.h>
+#include <string.h>
+
+/**************************** Prototypes *************************************/
+
+int _cls_alloc_slot();
+struct cls_connection* _cls_slot(int slot);
+int _cls_grow_fd_map(int socketFd);
 
 /**************************** Global constants *******************************/
 
 const int CLS_OK = 0;
 const int CLS_NO_SUCH_ELEMENT = -1;
 
-/**************************** Local types ************************************/
+/**************************** Local constants ********************************/
 
-typedef struct __cls_entry
-{
-	int socketFd;
-	struct __cls_entry* next;
-} _cls_entry;
+/* number of connection structs per slab chunk */
+#define CLS_CHUNK_SIZE 256
 
 /**************************** Local variables ********************************/
 
-_cls_entry* _cls_anchor = NULL;
+/* the slab: an array of pointers to chunks of CLS_CHUNK_SIZE structs */
+struct cls_connection** _cls_chunks = NULL;
+int _cls_num_chunks = 0;
+
+/* maps socket fd -> slot index, -1 if unused */
+int* _cls_fd_map = NULL;
+int _cls_fd_map_len = 0;
+
+/* head of the free list of slots, -1 if empty */
+int _cls_free_head = -1;
+
+/* number of connections in the list */
+int _cls_length = 0;
 
 /**************************** Module interface *******************************/
 
-void cls_add(int socketFd)
+struct cls_connection* cls_add(int socketFd)
 {
-	// Create a new node
-	_cls_entry* node = malloc(sizeof(_cls_entry));
-	node->socketFd = socketFd;
-	node->next = NULL;
+	if(socketFd < 0)
+		return NULL;
 
-	if(_cls_anchor == NULL)
+	if(socketFd >= _cls_fd_map_len)
 	{
-		_cls_anchor = node;
+		if(_cls_grow_fd_map(socketFd) == CLS_NO_SUCH_ELEMENT)
+			return NULL;
 	}
-	else
+	else if(_cls_fd_map[socketFd] != -1)
 	{
-		// Iterate to last element
-		_cls_entry* cur = _cls_anchor;
-		while(cur->next != NULL)
-			cur = cur->next;
-		// Append to list
-		cur->next = node;
+		return NULL;
 	}
+
+	int slot = _cls_alloc_slot();
+	if(slot == CLS_NO_SUCH_ELEMENT)
+		return NULL;
+
+	struct cls_connection* conn = _cls_slot(slot);
+	_cls_free_head = conn->nextFree;
+
+	memset(conn, 0, sizeof(struct cls_connection));
+	conn->socketFd = socketFd;
+	conn->nextFree = -1;
+
+	_cls_fd_map[socketFd] = slot;
+	++_cls_length;
+
+	return conn;
 }
 
 int cls_remove(int socketFd)
 {
-	if(_cls_anchor == NULL)
+	if((socketFd < 0) || (socketFd >= _cls_fd_map_len) || (_cls_fd_map[socketFd] == -1))
 		return CLS_NO_SUCH_ELEMENT;
 
-	// remove anchor?
-	if(_cls_anchor->socketFd == socketFd)
-	{
-		_cls_entry* old = _cls_anchor;
-		_cls_anchor = old->next;
-		free(old);
-		return CLS_OK;
-	}
-	else
-	{
-		if(_cls_anchor->next == NULL)
-			return CLS_NO_SUCH_ELEMENT;
-
-		// Iterate to desired element
-		_cls_entry* prev = _cls_anchor;
-		_cls_entry* cur = _cls_anchor->next;
-		while(cur->socketFd != socketFd)
-		{
-			if(cur->next == NULL)
-			{
-				return CLS_NO_SUCH_ELEMENT;
-			}
-			else
-			{
-				prev = cur;
-				cur = cur->next;
-			}
-		}
-
-		// Remove element
-		prev->next = cur->next;
-		free(cur);
-		return CLS_OK;
-	}
+	int slot = _cls_fd_map[socketFd];
+	struct cls_connection* conn = _cls_slot(slot);
+
+	// Push the slot onto the free list
+	conn->socketFd = -1;
+	conn->nextFree = _cls_free_head;
+	_cls_free_head = slot;
+
+	_cls_fd_map[socketFd] = -1;
+	--_cls_length;
+
+	return CLS_OK;
+}
+
+struct cls_connection* cls_lookup(int socketFd)
+{
+	if((socketFd < 0) || (socketFd >= _cls_fd_map_len) || (_cls_fd_map[socketFd] == -1))
+		return NULL;
+
+	return _cls_slot(_cls_fd_map[socketFd]);
 }
 
 int cls_get_length()
 {
-	if(_cls_anchor == NULL)
-	{
-		return 0;
-	}
-	else
-	{
-		int count = 1;
-		_cls_entry* cur = _cls_anchor;
-		while(cur->next != NULL)
-		{
-			cur = cur->next;
-			++count;
-		}
-		return count;
-	}
+	return _cls_length;
 }
 
-int cls_get(int index)
+struct cls_connection* cls_get(int slot)
 {
-	if(_cls_anchor == NULL)
-		return CLS_NO_SUCH_ELEMENT;
+	if((slot < 0) || (slot >= cls_get_capacity()))
+		return NULL;
 
-	_cls_entry* cur = _cls_anchor;
-	while(index > 0)
-	{
-		if(cur->next == NULL)
-		{
-			return CLS_NO_SUCH_ELEMENT;
-		}
-		else
-		{
-			cur = cur->next;
-			--index;
-		}
-	}
-	return cur->socketFd;
+	struct cls_connection* conn = _cls_slot(slot);
+	return (conn->socketFd == -1) ? NULL : conn;
+}
+
+int cls_get_capacity()
+{
+	return _cls_num_chunks * CLS_CHUNK_SIZE;
+}
+
+void cls_clean_up(void)
+{
+	int i;
+	for(i = 0; i < _cls_num_chunks; ++i)
+		free(_cls_chunks[i]);
+	free(_cls_chunks);
+	free(_cls_fd_map);
+
+	_cls_chunks = NULL;
+	_cls_num_chunks = 0;
+	_cls_fd_map = NULL;
+	_cls_fd_map_len = 0;
+	_cls_free_head = -1;
+	_cls_length = 0;
 }
 
-int cls_get_max()
+/**************************** Local methods **********************************/
+
+/*
+ * Returns a free slot index, adding a new chunk to the slab if the free
+ * list is empty. The slot stays at the head of the free list.
+ * Returns CLS_NO_SUCH_ELEMENT if out of memory.
+ */
+int _cls_alloc_slot()
 {
-	if(_cls_anchor == NULL)
+	if(_cls_free_head != -1)
+		return _cls_free_head;
+
+	struct cls_connection** chunks = realloc(_cls_chunks,
+			sizeof(struct cls_connection*) * (_cls_num_chunks + 1));
+	if(chunks == NULL)
 		return CLS_NO_SUCH_ELEMENT;
+	_cls_chunks = chunks;
 
-	int max = -1;
+	struct cls_connection* chunk = malloc(sizeof(struct cls_connection) * CLS_CHUNK_SIZE);
+	if(chunk == NULL)
+		return CLS_NO_SUCH_ELEMENT;
+	_cls_chunks[_cls_num_chunks] = chunk;
 
-	_cls_entry* cur = _cls_anchor;
-	while(cur != NULL)
+	// Thread the new slots onto the free list, lowest index first
+	int base = _cls_num_chunks * CLS_CHUNK_SIZE;
+	int i;
+	for(i = 0; i < CLS_CHUNK_SIZE; ++i)
 	{
-		if(cur->socketFd > max)
-			max = cur->socketFd;
-		cur = cur->next;
+		chunk[i].socketFd = -1;
+		chunk[i].nextFree = (i + 1 < CLS_CHUNK_SIZE) ? base + i + 1 : -1;
 	}
 
-	return max;
+	++_cls_num_chunks;
+	_cls_free_head = base;
+	return base;
+}
+
+/*
+ * Translates a slot index into its connection struct.
+ */
+struct cls_connection* _cls_slot(int slot)
+{
+	return &_cls_chunks[slot / CLS_CHUNK_SIZE][slot % CLS_CHUNK_SIZE];
+}
+
+/*
+ * Grows the fd map so that socketFd is a valid index.
+ * Returns CLS_OK or CLS_NO_SUCH_ELEMENT if out of memory.
+ */
+int _cls_grow_fd_map(int socketFd)
+{
+	int newLen = (_cls_fd_map_len > 0) ? _cls_fd_map_len : 1024;
+	while(newLen <= socketFd)
+		newLen *= 2;
+
+	int* map = realloc(_cls_fd_map, sizeof(int) * newLen);
+	if(map == NULL)
+		return CLS_NO_SUCH_ELEMENT;
+
+	int i;
+	for(i = _cls_fd_map_len; i < newLen; ++i)
+		map[i] = -1;
+
+	_cls_fd_map = map;
+	_cls_fd_map_len = newLen;
+	return CLS_OK;
 }
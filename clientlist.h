@@ -9,14 +9,62 @@
 #ifndef CLIENTLIST_H_
 #define CLIENTLIST_H_
 
-/**************************** Module constants *******************************/
+#include "outqueue.h"
+#include "request.h"
+#include "timers.h"
+
+#include <stdint.h> // for uint64_t
+#include <sys/socket.h> // for struct msghdr
+
+/**************************** Module types & constants ***********************/
+
+/*
+ * per-connection state. A connection struct stays at the same address
+ * until it is removed, so pointers to it may be kept while it is in use.
+ */
+struct cls_connection
+{
+	int socketFd; /* the client socket, -1 if the slot is free */
+	uint32_t clientAddr; /* IPv4 address of the client, network byte order */
+	struct tmr_timer timer; /* the connection's deadline */
+	int timeout; /* what the deadline is for (see networking.c) */
+	unsigned int timedRequests; /* value of requests when it was set */
+	unsigned int requests; /* number of requests handled on this connection */
+
+	char* inBuf; /* receive buffer, grows as needed */
+	size_t inLen; /* number of bytes in inBuf */
+	size_t inCap; /* allocated size of inBuf */
+	size_t inStart; /* offset of the request being parsed in inBuf */
+	struct req_parser parser; /* parser state of the request at inStart */
+	BOOL inputBlocked; /* reading stopped until the output is drained */
+	uint64_t lastRead; /* time of the last read, see met_now() */
+
+	struct oq_queue out; /* responses waiting to be sent */
+	BOOL closeAfterFlush; /* close the connection once out is drained */
+
+	/* io_uring engine only */
+	int ringOps; /* operations in flight */
+	BOOL ringRecv; /* a receive is in flight */
+	BOOL ringSend; /* output is in flight */
+	BOOL ringClosing; /* close once no operations are in flight */
+	int pipeFds[2]; /* pipe for splicing files to the socket, -1 until needed */
+	off_t pipeBytes; /* bytes in the pipe not yet sent */
+	struct msghdr sendMsg; /* the sendmsg() in flight */
+	struct iovec* sendIov; /* its vector, allocated when first needed */
+
+	int nextFree; /* next slot in the free list (internal) */
+};
 
 extern const int CLS_OK;
 extern const int CLS_NO_SUCH_ELEMENT;
 
 /**************************** Module interface *******************************/
 
-void cls_add(int socketFd);
+/*
+ * Adds a connection for socketFd and returns its (zeroed) state, or NULL if
+ * out of memory or socketFd is already in the list.
+ */
+struct cls_connection* cls_add(int socketFd);
 
 /*
  * Returns
@@ -25,17 +73,28 @@ void cls_add(int socketFd);
  */
 int cls_remove(int socketFd);
 
+/*
+ * Returns the state of the connection on socketFd, or NULL if there is none.
+ */
+struct cls_connection* cls_lookup(int socketFd);
+
 int cls_get_length();
 
 /*
- * Returns CLS_NO_SUCH_ELEMENT if index is out of range.
+ * Returns the connection in slot 'slot' or NULL if the slot is free or out of
+ * range. Together with cls_get_capacity() this allows to iterate over all
+ * connections; removing the returned connection while iterating is safe.
+ */
+struct cls_connection* cls_get(int slot);
+
+/*
+ * Returns the number of slots in the table (used and free).
  */
-int cls_get(int index);
+int cls_get_capacity();
 
 /*
- * Calculates the maximum file descriptor in the list.
- * Returns CLS_NO_SUCH_ELEMENT if the list is empty.
+ * Frees all memory held by the list. Does not close any socket.
  */
-int cls_get_max();
+void cls_clean_up(void);
 
 #endif /* CLIENTLIST_H_ */
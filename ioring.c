@@ -0,0 +1,304 @@
+/*
+ * ioring.c
+ *
+ * This file contains the module 'ioring', a thin layer over the io_uring
+ * system calls. It sets up a ring, hands out submission queue entries and
+ * walks the completion queue; batching the submissions of a whole loop
+ * iteration into one io_uring_enter() is up to the caller.
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#include "ioring.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**************************** Prototypes *************************************/
+
+BOOL _ior_map(struct ior_ring* ring, struct io_uring_params* params);
+BOOL _ior_probe(struct ior_ring* ring);
+
+/**************************** Global constants *******************************/
+
+const int IOR_OK = 0;
+const int IOR_NOT_SUPPORTED = 1;
+const int IOR_ERROR = 2;
+
+/**************************** Local constants ********************************/
+
+/* number of operations asked for when probing the kernel */
+#define IOR_PROBE_OPS 64
+
+/**************************** Module interface *******************************/
+
+int ior_init(struct ior_ring* ring, unsigned entries)
+{
+	memset(ring, 0, sizeof(struct ior_ring));
+	ring->fd = -1;
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(struct io_uring_params));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if(ring->fd < 0)
+		return ((errno == ENOSYS) || (errno == EPERM)) ? IOR_NOT_SUPPORTED : IOR_ERROR;
+
+	// Completions must never be dropped when the queue overflows
+	if((params.features & IORING_FEAT_NODROP) == 0)
+	{
+		ior_exit(ring);
+		return IOR_NOT_SUPPORTED;
+	}
+
+	if(_ior_map(ring, &params) == FALSE)
+	{
+		ior_exit(ring);
+		return IOR_ERROR;
+	}
+
+	if(_ior_probe(ring) == FALSE)
+	{
+		ior_exit(ring);
+		return IOR_NOT_SUPPORTED;
+	}
+
+	return IOR_OK;
+}
+
+void ior_exit(struct ior_ring* ring)
+{
+	if(ring->sqes != NULL)
+		munmap(ring->sqes, ring->sqesLen);
+	if((ring->cqMap != NULL) && (ring->cqMap != ring->sqMap))
+		munmap(ring->cqMap, ring->cqMapLen);
+	if(ring->sqMap != NULL)
+		munmap(ring->sqMap, ring->sqMapLen);
+	if(ring->fd >= 0)
+		close(ring->fd);
+
+	memset(ring, 0, sizeof(struct ior_ring));
+	ring->fd = -1;
+}
+
+struct io_uring_sqe* ior_get_sqe(struct ior_ring* ring, uint64_t userData)
+{
+	// Make room by submitting what has been prepared so far
+	unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	if(ring->sqLocalTail - head > ring->sqMask)
+	{
+		if(ior_submit_and_wait(ring, 0) != 0)
+			return NULL;
+		head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+		if(ring->sqLocalTail - head > ring->sqMask)
+			return NULL;
+	}
+
+	unsigned index = ring->sqLocalTail & ring->sqMask;
+	struct io_uring_sqe* sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->user_data = userData;
+	ring->sqArray[index] = index;
+	++ring->sqLocalTail;
+	return sqe;
+}
+
+BOOL ior_reserve(struct ior_ring* ring, unsigned count)
+{
+	unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	if(ring->sqLocalTail - head + count > ring->sqMask + 1)
+	{
+		if(ior_submit_and_wait(ring, 0) != 0)
+			return FALSE;
+		head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+		if(ring->sqLocalTail - head + count > ring->sqMask + 1)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+int ior_submit_and_wait(struct ior_ring* ring, unsigned waitNr)
+{
+	// Publish the new entries. Entries the kernel did not take last time
+	// are submitted again.
+	__atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+	unsigned toSubmit = ring->sqLocalTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+
+	unsigned flags = (waitNr > 0) ? IORING_ENTER_GETEVENTS : 0;
+	if(syscall(__NR_io_uring_enter, ring->fd, toSubmit, waitNr, flags, NULL, 0) < 0)
+		return -errno;
+	return 0;
+}
+
+struct io_uring_cqe* ior_peek_cqe(struct ior_ring* ring)
+{
+	unsigned head = *ring->cqHead;
+	if(head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &ring->cqes[head & ring->cqMask];
+}
+
+void ior_cqe_seen(struct ior_ring* ring)
+{
+	__atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+void ior_prep_accept(struct io_uring_sqe* sqe, int fd, struct sockaddr* addr, socklen_t* addrLen, int flags)
+{
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t) (uintptr_t) addr;
+	sqe->addr2 = (uint64_t) (uintptr_t) addrLen;
+	sqe->accept_flags = flags;
+}
+
+void ior_prep_recv(struct io_uring_sqe* sqe, int fd, void* buf, size_t len)
+{
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t) (uintptr_t) buf;
+	sqe->len = len;
+}
+
+void ior_prep_sendmsg(struct io_uring_sqe* sqe, int fd, const struct msghdr* msg, int flags)
+{
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t) (uintptr_t) msg;
+	sqe->len = 1;
+	sqe->msg_flags = flags;
+}
+
+void ior_prep_splice(struct io_uring_sqe* sqe, int fdIn, off_t offIn, int fdOut, unsigned len)
+{
+	sqe->opcode = IORING_OP_SPLICE;
+	sqe->fd = fdOut;
+	sqe->off = (uint64_t) -1;
+	sqe->splice_fd_in = fdIn;
+	sqe->splice_off_in = (uint64_t) offIn;
+	sqe->len = len;
+}
+
+void ior_prep_close(struct io_uring_sqe* sqe, int fd)
+{
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = fd;
+}
+
+void ior_prep_timeout(struct io_uring_sqe* sqe, struct __kernel_timespec* ts)
+{
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t) (uintptr_t) ts;
+	sqe->len = 1;
+}
+
+void ior_prep_poll_add(struct io_uring_sqe* sqe, int fd, unsigned events)
+{
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+}
+
+/**************************** Local methods **********************************/
+
+/*
+ * Maps the submission and completion queues and the submission queue
+ * entries. Returns FALSE on failure.
+ */
+BOOL _ior_map(struct ior_ring* ring, struct io_uring_params* params)
+{
+	ring->sqMapLen = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+	ring->cqMapLen = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+
+	// Newer kernels map both queues with a single mmap()
+	if(params->features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(ring->cqMapLen > ring->sqMapLen)
+			ring->sqMapLen = ring->cqMapLen;
+		ring->cqMapLen = ring->sqMapLen;
+	}
+
+	ring->sqMap = mmap(NULL, ring->sqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQ_RING);
+	if(ring->sqMap == MAP_FAILED)
+	{
+		ring->sqMap = NULL;
+		return FALSE;
+	}
+
+	if(params->features & IORING_FEAT_SINGLE_MMAP)
+	{
+		ring->cqMap = ring->sqMap;
+	}
+	else
+	{
+		ring->cqMap = mmap(NULL, ring->cqMapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				ring->fd, IORING_OFF_CQ_RING);
+		if(ring->cqMap == MAP_FAILED)
+		{
+			ring->cqMap = NULL;
+			return FALSE;
+		}
+	}
+
+	ring->sqesLen = params->sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQES);
+	if(ring->sqes == MAP_FAILED)
+	{
+		ring->sqes = NULL;
+		return FALSE;
+	}
+
+	char* sq = ring->sqMap;
+	ring->sqHead = (unsigned*) (sq + params->sq_off.head);
+	ring->sqTail = (unsigned*) (sq + params->sq_off.tail);
+	ring->sqMask = *(unsigned*) (sq + params->sq_off.ring_mask);
+	ring->sqArray = (unsigned*) (sq + params->sq_off.array);
+	ring->sqLocalTail = *ring->sqTail;
+
+	char* cq = ring->cqMap;
+	ring->cqHead = (unsigned*) (cq + params->cq_off.head);
+	ring->cqTail = (unsigned*) (cq + params->cq_off.tail);
+	ring->cqMask = *(unsigned*) (cq + params->cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*) (cq + params->cq_off.cqes);
+	return TRUE;
+}
+
+/*
+ * Checks that the kernel supports all operations prepared by this module.
+ */
+BOOL _ior_probe(struct ior_ring* ring)
+{
+	size_t len = sizeof(struct io_uring_probe) + IOR_PROBE_OPS * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe* probe = malloc(len);
+	if(probe == NULL)
+		return FALSE;
+	memset(probe, 0, len);
+
+	if(syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, IOR_PROBE_OPS) < 0)
+	{
+		free(probe);
+		return FALSE;
+	}
+
+	const int ops[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_SPLICE,
+			IORING_OP_CLOSE, IORING_OP_TIMEOUT, IORING_OP_POLL_ADD };
+	BOOL supported = TRUE;
+	size_t i;
+	for(i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i)
+	{
+		if((ops[i] > probe->last_op) || ((probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED) == 0))
+			supported = FALSE;
+	}
+
+	free(probe);
+	return supported;
+}
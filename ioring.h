@@ -0,0 +1,119 @@
+/*
+ * ioring.h
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#ifndef IORING_H_
+#define IORING_H_
+
+#include "base.h"
+
+#include <stdint.h> // for uint64_t
+#include <sys/socket.h> // for struct msghdr, struct sockaddr
+#include <sys/types.h> // for off_t
+#include <linux/io_uring.h>
+#include <linux/time_types.h> // for struct __kernel_timespec
+
+/**************************** Module types & constants ***********************/
+
+/*
+ * an io_uring instance with its submission and completion queues mapped
+ * into our address space
+ */
+struct ior_ring
+{
+	int fd;
+
+	/* submission queue */
+	unsigned* sqHead;
+	unsigned* sqTail;
+	unsigned sqMask;
+	unsigned* sqArray;
+	struct io_uring_sqe* sqes;
+	unsigned sqLocalTail; /* tail including entries not yet submitted */
+
+	/* completion queue */
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned cqMask;
+	struct io_uring_cqe* cqes;
+
+	/* mappings */
+	void* sqMap;
+	size_t sqMapLen;
+	void* cqMap;
+	size_t cqMapLen;
+	size_t sqesLen;
+};
+
+/*
+ * these constants are returned by ior_init().
+ */
+extern const int IOR_OK;
+extern const int IOR_NOT_SUPPORTED;
+extern const int IOR_ERROR;
+
+/**************************** Module interface *******************************/
+
+/*
+ * Sets up a ring with (at least) 'entries' submission queue entries.
+ * Returns IOR_OK, IOR_NOT_SUPPORTED if the kernel lacks io_uring or one of
+ * the operations used below, or IOR_ERROR.
+ */
+int ior_init(struct ior_ring* ring, unsigned entries);
+
+/*
+ * Tears the ring down. Operations still in flight are cancelled by the
+ * kernel.
+ */
+void ior_exit(struct ior_ring* ring);
+
+/*
+ * Returns a cleared submission queue entry tagged with 'userData'. If the
+ * submission queue is full, the prepared entries are submitted first.
+ * Returns NULL only if that fails.
+ */
+struct io_uring_sqe* ior_get_sqe(struct ior_ring* ring, uint64_t userData);
+
+/*
+ * Makes sure the next 'count' calls of ior_get_sqe() succeed without
+ * submitting anything, so linked entries are submitted together. The
+ * prepared entries are submitted first if necessary.
+ * Returns FALSE if that fails.
+ */
+BOOL ior_reserve(struct ior_ring* ring, unsigned count);
+
+/*
+ * Submits all prepared entries and waits until at least 'waitNr'
+ * completions are available, with a single system call.
+ * Returns 0 or a negative errno value (-EINTR if interrupted by a signal).
+ */
+int ior_submit_and_wait(struct ior_ring* ring, unsigned waitNr);
+
+/*
+ * Returns the next completion, or NULL if there is none. The completion
+ * has to be marked as seen with ior_cqe_seen() after looking at it.
+ */
+struct io_uring_cqe* ior_peek_cqe(struct ior_ring* ring);
+
+/*
+ * Hands the oldest completion back to the kernel.
+ */
+void ior_cqe_seen(struct ior_ring* ring);
+
+/*
+ * Helpers filling in a submission queue entry for one operation. The
+ * memory passed must stay valid until the operation has completed.
+ */
+void ior_prep_accept(struct io_uring_sqe* sqe, int fd, struct sockaddr* addr, socklen_t* addrLen, int flags);
+void ior_prep_recv(struct io_uring_sqe* sqe, int fd, void* buf, size_t len);
+void ior_prep_sendmsg(struct io_uring_sqe* sqe, int fd, const struct msghdr* msg, int flags);
+void ior_prep_splice(struct io_uring_sqe* sqe, int fdIn, off_t offIn, int fdOut, unsigned len);
+void ior_prep_close(struct io_uring_sqe* sqe, int fd);
+void ior_prep_timeout(struct io_uring_sqe* sqe, struct __kernel_timespec* ts);
+void ior_prep_poll_add(struct io_uring_sqe* sqe, int fd, unsigned events);
+
+#endif /* IORING_H_ */
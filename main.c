@@ -6,37 +6,121 @@
  *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
  */
 
+#include "base.h"
+#include "accesslog.h"
+#include "mempool.h"
+#include "metrics.h"
+#include "mimetypes.h"
 #include "networking.h"
 #include "resources.h"
+#include "worker.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 
 #include <signal.h>
+#include <unistd.h>
 
 void print_usage()
 {
 	printf("Usage:\n");
-	printf("\tcwebserver wwwpath [port]");
+	printf("\tcwebserver [-w workers] [-c] [-m cachesize] [-z] [-u] [-i] [-t mimetypes] [-s statspath] [-l logfile] [-b backlog] wwwpath [port]\n");
+	printf("\t-w workers\tnumber of worker processes (default 1)\n");
+	printf("\t-c\t\tpin each worker to its own CPU\n");
+	printf("\t-m cachesize\tcontent cache size per worker in KB, 0 to disable (default 16384)\n");
+	printf("\t-z\t\tcompress text files for clients accepting gzip\n");
+	printf("\t-u\t\tuse io_uring instead of epoll if the kernel supports it\n");
+	printf("\t-i\t\tindex the www tree at startup and watch it for changes\n");
+	printf("\t-t mimetypes\tread additional mime types from a mime.types file\n");
+	printf("\t-s statspath\tserve the server's metrics at this path (eg. /__stats)\n");
+	printf("\t-l logfile\tappend an access log (common log format plus latency in microseconds)\n");
+	printf("\t-b backlog\tlength of the queue of connections waiting to be accepted (default 4096)\n");
 }
 
 void on_sigint(int sig)
 {
 	printf("SIGINT received...\n");
+	// Stop the workers (if this is the master)
+	wrk_stop();
 	// Exit main loop
 	net_exit();
 }
 
 int main(int argc, char* argv[])
 {
-	if(argc < 2)
+	// Read options
+	int numWorkers = 1;
+	BOOL pinCpus = FALSE;
+	BOOL buildIndex = FALSE;
+	const char* logFile = NULL;
+
+	int opt;
+	while((opt = getopt(argc, argv, "w:cm:zuit:s:l:b:")) != -1)
+	{
+		if(opt == 'w')
+		{
+			numWorkers = atoi(optarg);
+			if(numWorkers < 1)
+				numWorkers = 1;
+		}
+		else if(opt == 'c')
+		{
+			pinCpus = TRUE;
+		}
+		else if(opt == 'm')
+		{
+			int cacheSize = atoi(optarg);
+			if(cacheSize < 0)
+				cacheSize = 0;
+			res_set_cache_size((size_t) cacheSize * 1024);
+		}
+		else if(opt == 'z')
+		{
+			res_set_compression(TRUE);
+		}
+		else if(opt == 'u')
+		{
+			net_use_io_uring(TRUE);
+		}
+		else if(opt == 'i')
+		{
+			buildIndex = TRUE;
+		}
+		else if(opt == 't')
+		{
+			if(mime_load(optarg) != MIME_OK)
+			{
+				fprintf(stderr, "Error: Could not read mime types from %s.\n", optarg);
+				return 1;
+			}
+		}
+		else if(opt == 's')
+		{
+			net_set_stats_path(optarg);
+		}
+		else if(opt == 'l')
+		{
+			logFile = optarg;
+		}
+		else if(opt == 'b')
+		{
+			net_set_backlog(atoi(optarg));
+		}
+		else
+		{
+			print_usage();
+			return 1;
+		}
+	}
+
+	if(argc - optind < 1)
 	{
 		print_usage();
 		return 1;
 	}
 
 	// Initialize resources module
-	if(res_set_www_path(argv[1]) == RES_INVALID_PATH)
+	if(res_set_www_path(argv[optind]) == RES_INVALID_PATH)
 	{
 		print_usage();
 		return 1;
@@ -44,26 +128,79 @@ int main(int argc, char* argv[])
 
 	// Read port number if given
 	int port = 80;
-	if(argc == 3)
+	if(argc - optind == 2)
 	{
-		port = atoi(argv[2]);
+		port = atoi(argv[optind + 1]);
 		if((port < 80) || (port > 65535))
 			port = 80;
 	}
 
+	// Attach signal handler to SIGINT
+	signal(SIGINT, on_sigint);
+
+	// Clients closing their connection early must not kill the server;
+	// failed writes are handled where they happen.
+	signal(SIGPIPE, SIG_IGN);
+
+	// The workers share the log file, but each has its own writer
+	if((logFile != NULL) && (alog_open(logFile) != ALOG_OK))
+	{
+		fprintf(stderr, "Error: Could not open access log %s.\n", logFile);
+		res_clean_up();
+		mime_clean_up();
+		return 1;
+	}
+
+	// The workers count into memory they all share
+	if(met_init(numWorkers) != MET_OK)
+		fprintf(stderr, "Error: Could not set up shared metrics, counting per worker.\n");
+
+	// Start the workers. The master only waits for them to finish.
+	int worker = wrk_start(numWorkers, pinCpus);
+	if(worker == WRK_ERROR)
+	{
+		alog_clean_up();
+		res_clean_up();
+		mime_clean_up();
+		met_clean_up();
+		return 1;
+	}
+	else if(worker == WRK_MASTER)
+	{
+		int ret = wrk_wait();
+		alog_clean_up();
+		res_clean_up();
+		mime_clean_up();
+		met_clean_up();
+		return ret;
+	}
+
+	met_set_worker(worker);
+
+	if(alog_start() != ALOG_OK)
+		fprintf(stderr, "Error: Could not start the access log writer, not logging.\n");
+
+	// Every worker keeps its own index of the www tree
+	if((buildIndex == TRUE) && (res_build_index() != RES_OK))
+		fprintf(stderr, "Error: Could not index the www path, looking files up in the file system.\n");
+
 	// Initialize networking module
 	if(net_start_up(port) != NET_OK)
 	{
+		alog_clean_up();
 		res_clean_up();
+		mime_clean_up();
+		met_clean_up();
 		return 1;
 	}
 
-	// Attach signal handler to SIGINT
-	signal(SIGINT, on_sigint);
-
 	// Enter main loop
 	net_main_loop();
 
+	alog_clean_up();
 	res_clean_up();
+	mime_clean_up();
+	met_clean_up();
+	mp_clean_up();
 	return 0;
 }
@@ -0,0 +1,190 @@
+/*
+ * mempool.c
+ *
+ * This file contains the module 'mempool'. Buffers which are needed again
+ * and again (receive buffers, output segments) are not given back to the
+ * heap but kept in free lists by size, so serving requests does not call
+ * malloc() once the pool has filled up. Each worker process has its own
+ * pool, which is therefore not locked.
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#include "base.h"
+#include "mempool.h"
+
+#include <stdlib.h>
+
+/**************************** Local types ************************************/
+
+/*
+ * a chunk of an arena
+ */
+struct _mp_chunk
+{
+	struct _mp_chunk* next; /* the chunk allocated from before */
+	size_t size; /* size of data */
+	char data[];
+};
+
+/*
+ * a buffer in a free list
+ */
+struct _mp_free
+{
+	struct _mp_free* next;
+};
+
+/**************************** Prototypes *************************************/
+
+int _mp_class(size_t size);
+
+/**************************** Local constants ********************************/
+
+/* the sizes pooled: powers of two from 2^MP_MIN_SHIFT to 2^MP_MAX_SHIFT;
+ * larger buffers come from the heap directly */
+#define MP_MIN_SHIFT 6
+#define MP_MAX_SHIFT 16
+#define MP_CLASSES (MP_MAX_SHIFT - MP_MIN_SHIFT + 1)
+
+/* bytes of free buffers kept per size, more are given back to the heap */
+#define MP_MAX_CACHED (4 * 1024 * 1024)
+
+/* size of an arena chunk (unless more is asked for at once) */
+#define MP_ARENA_CHUNK_SIZE 2048
+
+/* alignment of the memory handed out by arenas */
+#define MP_ALIGN 16
+
+/**************************** Local variables ********************************/
+
+/* the free buffers of each size, and their number */
+struct _mp_free* _mp_free_lists[MP_CLASSES];
+size_t _mp_free_count[MP_CLASSES];
+
+/**************************** Module interface *******************************/
+
+void* mp_get(size_t size)
+{
+	int cls = _mp_class(size);
+	if(cls < 0)
+		return malloc(size);
+
+	struct _mp_free* buf = _mp_free_lists[cls];
+	if(buf == NULL)
+		return malloc((size_t) 1 << (cls + MP_MIN_SHIFT));
+
+	_mp_free_lists[cls] = buf->next;
+	--_mp_free_count[cls];
+	return buf;
+}
+
+void mp_put(void* buf, size_t size)
+{
+	if(buf == NULL)
+		return;
+
+	int cls = _mp_class(size);
+	if((cls < 0) || ((_mp_free_count[cls] + 1) << (cls + MP_MIN_SHIFT) > MP_MAX_CACHED))
+	{
+		free(buf);
+		return;
+	}
+
+	struct _mp_free* entry = buf;
+	entry->next = _mp_free_lists[cls];
+	_mp_free_lists[cls] = entry;
+	++_mp_free_count[cls];
+}
+
+void mp_arena_init(struct mp_arena* arena)
+{
+	arena->chunks = NULL;
+	arena->used = 0;
+}
+
+void* mp_alloc(struct mp_arena* arena, size_t size)
+{
+	size = (size + MP_ALIGN - 1) & ~((size_t) MP_ALIGN - 1);
+
+	struct _mp_chunk* chunk = arena->chunks;
+	if((chunk == NULL) || (arena->used + size > chunk->size))
+	{
+		size_t chunkSize = sizeof(struct _mp_chunk) + size;
+		if(chunkSize < MP_ARENA_CHUNK_SIZE)
+			chunkSize = MP_ARENA_CHUNK_SIZE;
+
+		chunk = mp_get(chunkSize);
+		if(chunk == NULL)
+			return NULL;
+		chunk->size = chunkSize - sizeof(struct _mp_chunk);
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->used = 0;
+	}
+
+	void* ret = &chunk->data[arena->used];
+	arena->used += size;
+	return ret;
+}
+
+void mp_reset(struct mp_arena* arena)
+{
+	struct _mp_chunk* chunk = arena->chunks;
+	if(chunk == NULL)
+		return;
+
+	while(chunk->next != NULL)
+	{
+		struct _mp_chunk* earlier = chunk->next;
+		chunk->next = earlier->next;
+		mp_put(earlier, sizeof(struct _mp_chunk) + earlier->size);
+	}
+	arena->used = 0;
+}
+
+void mp_release(struct mp_arena* arena)
+{
+	while(arena->chunks != NULL)
+	{
+		struct _mp_chunk* chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		mp_put(chunk, sizeof(struct _mp_chunk) + chunk->size);
+	}
+	arena->used = 0;
+}
+
+void mp_clean_up(void)
+{
+	int cls;
+	for(cls = 0; cls < MP_CLASSES; ++cls)
+	{
+		while(_mp_free_lists[cls] != NULL)
+		{
+			struct _mp_free* buf = _mp_free_lists[cls];
+			_mp_free_lists[cls] = buf->next;
+			free(buf);
+		}
+		_mp_free_count[cls] = 0;
+	}
+}
+
+/**************************** Local methods **********************************/
+
+/*
+ * Returns the size class of a buffer of 'size' bytes (the pooled buffers of
+ * class i have 2^(i + MP_MIN_SHIFT) bytes), or -1 if it is not pooled.
+ */
+int _mp_class(size_t size)
+{
+	if(size <= ((size_t) 1 << MP_MIN_SHIFT))
+		return 0;
+	if(size > ((size_t) 1 << MP_MAX_SHIFT))
+		return -1;
+
+	// Number of bits of size - 1, i.e. the exponent of the power of two
+	// rounding it up
+	return (int) (sizeof(unsigned long) * 8 - __builtin_clzl(size - 1)) - MP_MIN_SHIFT;
+}
@@ -0,0 +1,73 @@
+/*
+ * mempool.h
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#ifndef MEMPOOL_H_
+#define MEMPOOL_H_
+
+#include "base.h"
+
+#include <stddef.h> // for size_t
+
+/**************************** Module types & constants ***********************/
+
+struct _mp_chunk;
+
+/*
+ * A bump allocator: memory is handed out from chunks taken from the buffer
+ * pool and only given back all at once. A zeroed arena is empty.
+ */
+struct mp_arena
+{
+	struct _mp_chunk* chunks; /* the chunk allocated from, followed by the earlier ones */
+	size_t used; /* bytes used of it */
+};
+
+/**************************** Module interface *******************************/
+
+/*
+ * Returns a buffer of at least 'size' bytes, or NULL if out of memory.
+ * Buffers are taken from the pool of buffers given back before if
+ * possible; sizes are rounded up to a power of two for that.
+ */
+void* mp_get(size_t size);
+
+/*
+ * Gives a buffer back to the pool. 'size' has to be the size it was asked
+ * for with. 'buf' may be NULL.
+ */
+void mp_put(void* buf, size_t size);
+
+/*
+ * Initializes an empty arena.
+ */
+void mp_arena_init(struct mp_arena* arena);
+
+/*
+ * Returns 'size' bytes (suitably aligned for any type) from the arena, or
+ * NULL if out of memory.
+ */
+void* mp_alloc(struct mp_arena* arena, size_t size);
+
+/*
+ * Frees everything allocated from the arena at once. The chunk allocated
+ * from last is kept for what is allocated next.
+ */
+void mp_reset(struct mp_arena* arena);
+
+/*
+ * Frees everything allocated from the arena and gives its chunks back to
+ * the pool.
+ */
+void mp_release(struct mp_arena* arena);
+
+/*
+ * Clean-up method. Frees the buffers kept in the pool.
+ */
+void mp_clean_up(void);
+
+#endif /* MEMPOOL_H_ */
@@ -0,0 +1,240 @@
+/*
+ * metrics.c
+ *
+ * This file contains the module 'metrics'. Each worker counts connections,
+ * responses, bytes and cache hits in its own slot of a shared memory area;
+ * the slots are only summed up when a report is asked for, so counting
+ * costs an increment without any locking or atomic operations.
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#include "base.h"
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <time.h>
+
+/**************************** Local constants ********************************/
+
+/* the status codes counted separately; others are counted as 'other' */
+static const int _met_statuses[] = { 200, 206, 304, 400, 401, 404, 416, 500, 501 };
+#define MET_NUM_STATUSES (sizeof(_met_statuses) / sizeof(_met_statuses[0]))
+
+/* latency buckets: bucket i counts latencies from 2^(i-1) up to 2^i
+ * microseconds (the first one 0, the last one everything above) */
+#define MET_LATENCY_BUCKETS 24
+
+/**************************** Local types ************************************/
+
+/*
+ * the counters of one worker, on cache lines of their own
+ */
+struct _met_counters
+{
+	uint64_t accepted;
+	uint64_t closed;
+	uint64_t responses[MET_NUM_STATUSES + 1]; /* the last one for other codes */
+	uint64_t bytesSent;
+	uint64_t cacheHits;
+	uint64_t cacheMisses;
+	uint64_t logDropped;
+	uint64_t latency[MET_LATENCY_BUCKETS];
+} __attribute__((aligned(64)));
+
+/**************************** Prototypes *************************************/
+
+int _met_status_index(int status);
+void _met_append(char* buf, size_t size, size_t* len, const char* format, ...)
+	__attribute__((format(printf, 4, 5)));
+
+/**************************** Global constants *******************************/
+
+const int MET_OK = 0;
+const int MET_ERROR = 1;
+
+/**************************** Local variables ********************************/
+
+/* counters used until (or unless) the shared ones are set up */
+struct _met_counters _met_private;
+
+/* the shared counters of all workers, and their number */
+struct _met_counters* _met_workers;
+int _met_num_workers;
+
+/* the counters of this process */
+struct _met_counters* _met_local = &_met_private;
+
+/**************************** Module interface *******************************/
+
+int met_init(int numWorkers)
+{
+	if(numWorkers < 1)
+		numWorkers = 1;
+
+	void* area = mmap(NULL, numWorkers * sizeof(struct _met_counters), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(area == MAP_FAILED)
+		return MET_ERROR;
+
+	_met_workers = area;
+	_met_num_workers = numWorkers;
+	_met_local = &_met_workers[0];
+	return MET_OK;
+}
+
+void met_set_worker(int worker)
+{
+	if((worker >= 0) && (worker < _met_num_workers))
+		_met_local = &_met_workers[worker];
+}
+
+void met_count_accept(void)
+{
+	++_met_local->accepted;
+}
+
+void met_count_close(void)
+{
+	++_met_local->closed;
+}
+
+void met_count_response(int status, uint64_t latency)
+{
+	++_met_local->responses[_met_status_index(status)];
+
+	// Index of the highest bit set, plus one
+	int bucket = (latency > 0) ? 64 - __builtin_clzll(latency) : 0;
+	if(bucket >= MET_LATENCY_BUCKETS)
+		bucket = MET_LATENCY_BUCKETS - 1;
+	++_met_local->latency[bucket];
+}
+
+void met_count_bytes(uint64_t bytes)
+{
+	_met_local->bytesSent += bytes;
+}
+
+void met_count_cache(BOOL hit)
+{
+	if(hit == TRUE)
+		++_met_local->cacheHits;
+	else
+		++_met_local->cacheMisses;
+}
+
+void met_count_log_drop(void)
+{
+	++_met_local->logDropped;
+}
+
+uint64_t met_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+size_t met_report(char* buf, size_t size)
+{
+	// Sum up the workers. Counters may move on while doing so, which only
+	// makes the totals slightly inconsistent.
+	struct _met_counters total;
+	memset(&total, 0, sizeof(struct _met_counters));
+
+	struct _met_counters* workers = (_met_workers != NULL) ? _met_workers : &_met_private;
+	int numWorkers = (_met_workers != NULL) ? _met_num_workers : 1;
+	int w;
+	size_t i;
+	for(w = 0; w < numWorkers; ++w)
+	{
+		const volatile struct _met_counters* counters = &workers[w];
+		total.accepted += counters->accepted;
+		total.closed += counters->closed;
+		for(i = 0; i <= MET_NUM_STATUSES; ++i)
+			total.responses[i] += counters->responses[i];
+		total.bytesSent += counters->bytesSent;
+		total.cacheHits += counters->cacheHits;
+		total.cacheMisses += counters->cacheMisses;
+		total.logDropped += counters->logDropped;
+		for(i = 0; i < MET_LATENCY_BUCKETS; ++i)
+			total.latency[i] += counters->latency[i];
+	}
+
+	uint64_t requests = 0;
+	for(i = 0; i <= MET_NUM_STATUSES; ++i)
+		requests += total.responses[i];
+	uint64_t lookups = total.cacheHits + total.cacheMisses;
+
+	size_t len = 0;
+	_met_append(buf, size, &len, "workers %d\n", numWorkers);
+	_met_append(buf, size, &len, "connections_accepted %llu\n", (unsigned long long) total.accepted);
+	_met_append(buf, size, &len, "connections_active %llu\n", (unsigned long long) (total.accepted - total.closed));
+	_met_append(buf, size, &len, "requests %llu\n", (unsigned long long) requests);
+	for(i = 0; i < MET_NUM_STATUSES; ++i)
+		_met_append(buf, size, &len, "responses_%d %llu\n", _met_statuses[i], (unsigned long long) total.responses[i]);
+	_met_append(buf, size, &len, "responses_other %llu\n", (unsigned long long) total.responses[MET_NUM_STATUSES]);
+	_met_append(buf, size, &len, "bytes_sent %llu\n", (unsigned long long) total.bytesSent);
+	_met_append(buf, size, &len, "cache_hits %llu\n", (unsigned long long) total.cacheHits);
+	_met_append(buf, size, &len, "cache_misses %llu\n", (unsigned long long) total.cacheMisses);
+	_met_append(buf, size, &len, "cache_hit_rate %.3f\n", (lookups > 0) ? (double) total.cacheHits / lookups : 0.0);
+	_met_append(buf, size, &len, "access_log_dropped %llu\n", (unsigned long long) total.logDropped);
+
+	// Cumulative: the number of responses faster than the bound
+	uint64_t faster = 0;
+	for(i = 0; i < MET_LATENCY_BUCKETS - 1; ++i)
+	{
+		faster += total.latency[i];
+		_met_append(buf, size, &len, "latency_us_below_%llu %llu\n", 1ULL << i, (unsigned long long) faster);
+	}
+	return len;
+}
+
+void met_clean_up(void)
+{
+	if(_met_workers != NULL)
+		munmap(_met_workers, _met_num_workers * sizeof(struct _met_counters));
+	_met_workers = NULL;
+	_met_num_workers = 0;
+	_met_local = &_met_private;
+}
+
+/**************************** Local methods **********************************/
+
+/*
+ * Returns the index of the counter of a status code.
+ */
+int _met_status_index(int status)
+{
+	size_t i;
+	for(i = 0; i < MET_NUM_STATUSES; ++i)
+	{
+		if(_met_statuses[i] == status)
+			return i;
+	}
+	return MET_NUM_STATUSES;
+}
+
+/*
+ * Appends formatted text to the 'len' bytes in 'buf', as far as it fits.
+ */
+void _met_append(char* buf, size_t size, size_t* len, const char* format, ...)
+{
+	if(*len + 1 >= size)
+		return;
+
+	va_list args;
+	va_start(args, format);
+	int ret = vsnprintf(&buf[*len], size - *len, format, args);
+	va_end(args);
+
+	if(ret < 0)
+		return;
+	*len = ((size_t) ret >= size - *len) ? size - 1 : *len + ret;
+}
@@ -0,0 +1,70 @@
+/*
+ * metrics.h
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include "base.h"
+
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint64_t
+
+/**************************** Module types & constants ***********************/
+
+/*
+ * returned by met_init().
+ */
+extern const int MET_OK;
+extern const int MET_ERROR;
+
+/**************************** Module interface *******************************/
+
+/*
+ * Sets up counters for 'numWorkers' workers in memory shared by all of
+ * them, so any worker can report the totals. Has to be called before the
+ * workers are started. Without it, each process only counts for itself.
+ * Returns MET_OK or MET_ERROR.
+ */
+int met_init(int numWorkers);
+
+/*
+ * Selects the counters the calling worker updates (0..numWorkers-1).
+ * Every counter has a single writer, so updating it is a plain increment.
+ */
+void met_set_worker(int worker);
+
+/*
+ * Counting methods, called on the respective events.
+ * 'latency' is the time from reading a request to queueing its response in
+ * microseconds (see met_now()).
+ */
+void met_count_accept(void);
+void met_count_close(void);
+void met_count_response(int status, uint64_t latency);
+void met_count_bytes(uint64_t bytes);
+void met_count_cache(BOOL hit);
+void met_count_log_drop(void);
+
+/*
+ * Returns a monotonic timestamp in microseconds.
+ */
+uint64_t met_now(void);
+
+/*
+ * Writes a plain text report of the counters summed over all workers into
+ * 'buf' (one "name value" pair per line). Returns the length of the report,
+ * which is cut short if 'size' is too small.
+ */
+size_t met_report(char* buf, size_t size);
+
+/*
+ * Clean-up method. Has to be called when the server exits.
+ */
+void met_clean_up(void);
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,332 @@
+/*
+ * mimetypes.c
+ *
+ * This file contains the module 'mimetypes'. It maps file extensions to
+ * mime types using a hash table, which holds the common web types and may
+ * be extended or overridden from a mime.types file.
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#include "base.h"
+#include "mimetypes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**************************** Local types ************************************/
+
+/*
+ * a slot of the (open addressing) hash table: an extension and its type
+ */
+struct _mime_slot
+{
+	char* ext; /* lower case, NULL if the slot is free */
+	unsigned int hash;
+	const char* type;
+};
+
+/*
+ * a registered mime type. Types are allocated once per line they appear in
+ * and shared by all extensions of that line.
+ */
+struct _mime_type
+{
+	struct _mime_type* next;
+	char name[];
+};
+
+/**************************** Prototypes *************************************/
+
+BOOL _mime_init(void);
+BOOL _mime_parse_line(char* line);
+BOOL _mime_register(const char* ext, const char* type);
+struct _mime_slot* _mime_find(const char* ext, unsigned int hash);
+BOOL _mime_grow(void);
+void _mime_lower(char* key, const char* ext, size_t len);
+unsigned int _mime_hash(const char* ext);
+
+/**************************** Global constants *******************************/
+
+const int MIME_OK = 0;
+const int MIME_IO_ERROR = 1;
+
+/**************************** Local constants ********************************/
+
+/* initial number of slots of the hash table (power of two) */
+#define MIME_INITIAL_SLOTS 128
+
+/* longer extensions are never looked up */
+#define MIME_MAX_EXTENSION 15
+
+/* characters separating the fields of a mime.types line */
+#define MIME_SEPARATORS " \t\r\n"
+
+/* the types known without a mime.types file, in its format */
+static const char* _mime_defaults[] =
+{
+	"text/html html htm",
+	"text/css css",
+	"text/javascript js mjs",
+	"text/plain txt",
+	"text/csv csv",
+	"application/json json map",
+	"application/xml xml",
+	"application/xhtml+xml xhtml",
+	"application/wasm wasm",
+	"application/pdf pdf",
+	"application/zip zip",
+	"image/jpeg jpg jpeg",
+	"image/gif gif",
+	"image/png png",
+	"image/svg+xml svg",
+	"image/webp webp",
+	"image/avif avif",
+	"image/x-icon ico",
+	"font/woff woff",
+	"font/woff2 woff2",
+	"font/ttf ttf",
+	"font/otf otf",
+	"audio/mpeg mp3",
+	"audio/ogg ogg",
+	"video/mp4 mp4",
+	"video/webm webm",
+	NULL
+};
+
+/**************************** Local variables ********************************/
+
+/* the hash table, its number of slots and of used slots */
+struct _mime_slot* _mime_table;
+unsigned int _mime_slots;
+unsigned int _mime_used;
+
+/* all registered types */
+struct _mime_type* _mime_types;
+
+/**************************** Module interface *******************************/
+
+int mime_load(const char* file)
+{
+	if((_mime_table == NULL) && (_mime_init() == FALSE))
+		return MIME_IO_ERROR;
+
+	FILE* f = fopen(file, "r");
+	if(f == NULL)
+		return MIME_IO_ERROR;
+
+	char* line = NULL;
+	size_t lineSize = 0;
+	BOOL ok = TRUE;
+	while((ok == TRUE) && (getline(&line, &lineSize, f) != -1))
+		ok = _mime_parse_line(line);
+
+	free(line);
+	fclose(f);
+	return (ok == TRUE) ? MIME_OK : MIME_IO_ERROR;
+}
+
+const char* mime_lookup(const char* path)
+{
+	if((_mime_table == NULL) && (_mime_init() == FALSE))
+		return NULL;
+
+	// Find the extension of the file name; names like '.ext' have none
+	const char* name = strrchr(path, '/');
+	name = (name != NULL) ? name + 1 : path;
+	const char* dot = strrchr(name, '.');
+	if((dot == NULL) || (dot == name))
+		return NULL;
+
+	const char* ext = dot + 1;
+	size_t len = strlen(ext);
+	if((len == 0) || (len > MIME_MAX_EXTENSION))
+		return NULL;
+
+	char key[MIME_MAX_EXTENSION + 1];
+	_mime_lower(key, ext, len);
+
+	struct _mime_slot* slot = _mime_find(key, _mime_hash(key));
+	return slot->type;
+}
+
+void mime_clean_up(void)
+{
+	unsigned int i;
+	for(i = 0; i < _mime_slots; ++i)
+		free(_mime_table[i].ext);
+	free(_mime_table);
+	_mime_table = NULL;
+	_mime_slots = 0;
+	_mime_used = 0;
+
+	while(_mime_types != NULL)
+	{
+		struct _mime_type* type = _mime_types;
+		_mime_types = type->next;
+		free(type);
+	}
+}
+
+/**************************** Local methods **********************************/
+
+/*
+ * Creates the hash table and registers the default types.
+ * Returns FALSE if out of memory.
+ */
+BOOL _mime_init(void)
+{
+	_mime_table = calloc(MIME_INITIAL_SLOTS, sizeof(struct _mime_slot));
+	if(_mime_table == NULL)
+		return FALSE;
+	_mime_slots = MIME_INITIAL_SLOTS;
+
+	int i;
+	for(i = 0; _mime_defaults[i] != NULL; ++i)
+	{
+		char line[64];
+		strcpy(line, _mime_defaults[i]);
+		if(_mime_parse_line(line) == FALSE)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Registers the extensions of a line of a mime.types file. Comments and
+ * lines without a valid type are skipped. Modifies 'line'.
+ * Returns FALSE if out of memory.
+ */
+BOOL _mime_parse_line(char* line)
+{
+	char* comment = strchr(line, '#');
+	if(comment != NULL)
+		*comment = '\0';
+
+	char* save;
+	char* name = strtok_r(line, MIME_SEPARATORS, &save);
+	if((name == NULL) || (strchr(name, '/') == NULL))
+		return TRUE;
+
+	char* ext = strtok_r(NULL, MIME_SEPARATORS, &save);
+	if(ext == NULL)
+		return TRUE;
+
+	struct _mime_type* type = malloc(sizeof(struct _mime_type) + strlen(name) + 1);
+	if(type == NULL)
+		return FALSE;
+	strcpy(type->name, name);
+	type->next = _mime_types;
+	_mime_types = type;
+
+	for(; ext != NULL; ext = strtok_r(NULL, MIME_SEPARATORS, &save))
+	{
+		if(_mime_register(ext, type->name) == FALSE)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Maps the extension 'ext' to 'type', replacing an earlier mapping.
+ * Extensions too long to be looked up are ignored.
+ * Returns FALSE if out of memory.
+ */
+BOOL _mime_register(const char* ext, const char* type)
+{
+	size_t len = strlen(ext);
+	if(len > MIME_MAX_EXTENSION)
+		return TRUE;
+
+	char key[MIME_MAX_EXTENSION + 1];
+	_mime_lower(key, ext, len);
+
+	// Keep at least half of the slots free, so probe sequences stay short
+	if((2 * (_mime_used + 1) > _mime_slots) && (_mime_grow() == FALSE))
+		return FALSE;
+
+	unsigned int hash = _mime_hash(key);
+	struct _mime_slot* slot = _mime_find(key, hash);
+	if(slot->ext == NULL)
+	{
+		slot->ext = malloc(len + 1);
+		if(slot->ext == NULL)
+			return FALSE;
+		strcpy(slot->ext, key);
+		slot->hash = hash;
+		++_mime_used;
+	}
+	slot->type = type;
+	return TRUE;
+}
+
+/*
+ * Returns the slot of the (lower case) extension 'ext', or the free slot
+ * where it would be inserted.
+ */
+struct _mime_slot* _mime_find(const char* ext, unsigned int hash)
+{
+	unsigned int i = hash & (_mime_slots - 1);
+	while((_mime_table[i].ext != NULL) &&
+		((_mime_table[i].hash != hash) || (strcmp(_mime_table[i].ext, ext) != 0)))
+		i = (i + 1) & (_mime_slots - 1);
+	return &_mime_table[i];
+}
+
+/*
+ * Doubles the number of slots of the hash table. Returns FALSE if out of
+ * memory.
+ */
+BOOL _mime_grow(void)
+{
+	struct _mime_slot* old = _mime_table;
+	unsigned int oldSlots = _mime_slots;
+
+	_mime_table = calloc(2 * oldSlots, sizeof(struct _mime_slot));
+	if(_mime_table == NULL)
+	{
+		_mime_table = old;
+		return FALSE;
+	}
+	_mime_slots = 2 * oldSlots;
+
+	unsigned int i;
+	for(i = 0; i < oldSlots; ++i)
+	{
+		if(old[i].ext != NULL)
+			*_mime_find(old[i].ext, old[i].hash) = old[i];
+	}
+
+	free(old);
+	return TRUE;
+}
+
+/*
+ * Copies the extension 'ext' of length 'len' (plus terminator) to 'key' in
+ * lower case.
+ */
+void _mime_lower(char* key, const char* ext, size_t len)
+{
+	size_t i;
+	for(i = 0; i <= len; ++i)
+		key[i] = ((ext[i] >= 'A') && (ext[i] <= 'Z')) ? ext[i] - 'A' + 'a' : ext[i];
+}
+
+/*
+ * FNV-1a hash of an extension.
+ */
+unsigned int _mime_hash(const char* ext)
+{
+	unsigned int hash = 2166136261u;
+	while(*ext != '\0')
+	{
+		hash ^= (unsigned char) *ext++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
@@ -0,0 +1,47 @@
+/*
+ * mimetypes.h
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#ifndef MIMETYPES_H_
+#define MIMETYPES_H_
+
+#include "base.h"
+
+/**************************** Module types & constants ***********************/
+
+/*
+ * returned by mime_load().
+ */
+extern const int MIME_OK;
+extern const int MIME_IO_ERROR;
+
+/**************************** Module interface *******************************/
+
+/*
+ * Reads a mime.types file (lines of a mime type followed by its file
+ * extensions, '#' starts a comment) and registers its types, replacing
+ * earlier registrations of the same extensions. The common web types are
+ * registered without a file. Has to be called at startup, before the first
+ * lookup.
+ * Returns MIME_OK, or MIME_IO_ERROR if the file could not be read.
+ */
+int mime_load(const char* file);
+
+/*
+ * Returns the mime type of the file 'path' according to its extension (the
+ * part of the file name after the last dot, matched case-insensitively), or
+ * NULL if the extension is unknown or there is none. The string is owned by
+ * the registry and lives until mime_clean_up() is called.
+ */
+const char* mime_lookup(const char* path);
+
+/*
+ * Clean-up method. Has to be called when the server exits.
+ */
+void mime_clean_up(void);
+
+#endif /* MIMETYPES_H_ */
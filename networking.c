@@ -2,25 +2,41 @@
  * networking.c
  *
  * This file contains all the networking stuff, like listening on a socket,
- * selecting, and reading from a socket.
+ * waiting for events (epoll), and reading from a socket. Alternatively,
+ * sockets are driven by completions of an io_uring.
  *
  *  Created on: 09.01.2010
  *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
  *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
  */
 
+#define _GNU_SOURCE // for pipe2
+
 #include "base.h"
 #include "networking.h"
+#include "accesslog.h"
 #include "clientlist.h"
+#include "ioring.h"
+#include "mempool.h"
+#include "metrics.h"
+#include "outqueue.h"
 #include "resources.h"
+#include "timers.h"
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
 
 /**************************** HTML error pages *******************************/
@@ -29,43 +45,96 @@ struct _net_html_error_page
 {
 	char* msg;
 	char* content;
+	char header[128]; /* status line and entity headers, built at start up */
+	int headerLen;
+	int status; /* the status code, taken from 'msg' at start up */
 };
 
-const struct _net_html_error_page _net_400_page =
+struct _net_html_error_page _net_400_page =
 {
 		"400 Bad request",
 		"<html><head><title>400 - Bad request</title></head><body><h3>Your HTTP request was malformed.</h3></body></html>"
 };
 
-const struct _net_html_error_page _net_401_page =
+struct _net_html_error_page _net_401_page =
 {
 		"401 Access denied",
 		"<html><head><title>401 - Access denied</title></head><body><h3>Access denied.</h3></body></html>"
 };
 
-const struct _net_html_error_page _net_404_page =
+struct _net_html_error_page _net_404_page =
 {
 		"404 File not found",
 		"<html><head><title>404 - File not found</title></head><body><h3>The page was not found.</h3></body></html>"
 };
 
-const struct _net_html_error_page _net_500_page =
+struct _net_html_error_page _net_500_page =
 {
 		"500 Internal server error",
 		"<html><head><title>500 - Internal server error</title></head><body><h3>An error happened while processing your request.</h3></body></html>"
 };
 
+struct _net_html_error_page _net_501_page =
+{
+		"501 Not implemented",
+		"<html><head><title>501 - Not implemented</title></head><body><h3>Only GET and HEAD requests are supported.</h3></body></html>"
+};
+
+/**************************** Static header lines ****************************/
+
+const char _net_status_200[] = "HTTP/1.1 200 OK\r\n";
+const char _net_status_206[] = "HTTP/1.1 206 Partial Content\r\n";
+const char _net_status_304[] = "HTTP/1.1 304 Not Modified\r\n";
+const char _net_status_416[] = "HTTP/1.1 416 Range Not Satisfiable\r\n";
+const char _net_keep_alive_end[] = "Connection: keep-alive\r\n\r\n";
+const char _net_close_end[] = "Connection: close\r\n\r\n";
+const char _net_no_store[] = "Cache-Control: no-store\r\n";
 
 /**************************** Prototypes *************************************/
 
-BOOL _net_select(fd_set* fds);
-void _net_accept_connections(fd_set* fds);
-void _net_read_http_requests(fd_set* fds);
-void _net_handle_http_request(char* request, int socket);
-char* _net_get_resource_path(char* request);
-void _net_send_resource(struct res_resource* resinfo, int socket);
-void _net_send_error_page(const struct _net_html_error_page* error, int socket);
-char* _net_generate_header(const char* status, int len, const char* mime);
+int _net_wait(struct epoll_event* events, int maxEvents);
+BOOL _net_watch(int fd, uint32_t events);
+BOOL _net_set_nonblocking(int fd);
+BOOL _net_accept_connections();
+void _net_handle_event(int socket, uint32_t events);
+void _net_handle_input(struct cls_connection* conn);
+int _net_fill_input_buffer(struct cls_connection* conn);
+BOOL _net_grow_input_buffer(struct cls_connection* conn);
+BOOL _net_process_input(struct cls_connection* conn);
+BOOL _net_queue_responses(struct cls_connection* conn);
+int _net_request_body(struct cls_connection* conn);
+char* _net_request(struct cls_connection* conn);
+BOOL _net_flush_output(struct cls_connection* conn);
+void _net_close_connection(int socket);
+void _net_expire_timeouts();
+void _net_update_timeout(struct cls_connection* conn);
+void _net_set_timeout(struct cls_connection* conn, int timeout);
+void _net_handle_http_request(struct cls_connection* conn, BOOL keepAlive);
+void _net_queue_resource(struct cls_connection* conn, struct res_resource* resinfo, BOOL keepAlive, BOOL head);
+int _net_select_range(struct cls_connection* conn, const struct res_resource* resinfo, off_t* offset, off_t* len);
+BOOL _net_not_modified(struct cls_connection* conn, const struct res_resource* resinfo);
+BOOL _net_etag_matches(const char* list, size_t len, const char* etag, size_t etagLen);
+void _net_queue_error_page(struct cls_connection* conn, const struct _net_html_error_page* error, BOOL keepAlive, BOOL head);
+void _net_queue_stats(struct cls_connection* conn, BOOL keepAlive, BOOL head);
+void _net_count_response(struct cls_connection* conn, int status, uint64_t bodyLen);
+void _net_log_request(struct cls_connection* conn, int status, uint64_t bodyLen, uint64_t latency);
+BOOL _net_queue_header_end(struct cls_connection* conn, BOOL keepAlive);
+void _net_prepare_error_page(struct _net_html_error_page* error);
+int _net_generate_header(char* buf, size_t size, const char* status, off_t len, const char* mime);
+BOOL _net_ring_start_up();
+void _net_ring_main_loop();
+void _net_ring_complete(uint64_t tag, int res);
+void _net_ring_accepted(int socket, const struct sockaddr_in* client);
+void _net_ring_continue(struct cls_connection* conn);
+BOOL _net_ring_send(struct cls_connection* conn);
+BOOL _net_ring_recv(struct cls_connection* conn);
+void _net_ring_close(struct cls_connection* conn);
+void _net_ring_finish_close(struct cls_connection* conn);
+void _net_ring_close_fd(int fd);
+void _net_ring_arm_accept(int slot);
+void _net_ring_arm_tick();
+void _net_ring_arm_index();
+struct io_uring_sqe* _net_ring_sqe(struct cls_connection* conn, int op);
 
 /**************************** Global constants *******************************/
 
@@ -73,6 +142,96 @@ const int NET_OK = 0;
 const int NET_SOCKET_ERROR = 1;
 const int NET_BIND_ERROR = 2;
 const int NET_LISTEN_ERROR = 3;
+const int NET_EPOLL_ERROR = 4;
+
+/**************************** Local constants ********************************/
+
+/* maximum number of events fetched by a single epoll_wait() */
+#define NET_MAX_EVENTS 256
+
+/* maximum number of connections accepted at once by the epoll loop, so a
+ * burst of them does not hold up the connections already open */
+#define NET_MAX_ACCEPTS 64
+
+/* default length of the queue of connections waiting to be accepted (the
+ * kernel cuts it down to net.core.somaxconn) */
+#define NET_DEFAULT_BACKLOG 4096
+
+/* initial size of a connection's receive buffer */
+#define NET_INPUT_BUFFER_SIZE 2048
+
+/* maximum size of a request (request line and headers) */
+#define NET_MAX_REQUEST_SIZE 32768
+
+/* results of _net_fill_input_buffer() */
+#define NET_READ_DRAINED 0
+#define NET_READ_FULL 1
+#define NET_READ_CLOSED 2
+#define NET_READ_EOF 3
+
+/* number of requests served on a persistent connection before it is closed */
+#define NET_KEEP_ALIVE_MAX_REQUESTS 100
+
+/* deadlines in milliseconds: for the (next) request to start, once it
+ * has started for it to be complete, and for the client to take more of a
+ * response */
+#define NET_KEEP_ALIVE_TIMEOUT 5000
+#define NET_HEADER_TIMEOUT 10000
+#define NET_SEND_TIMEOUT 30000
+
+/* what a connection is waiting for (conn->timeout), each with one of the
+ * deadlines above */
+#define NET_WAIT_REQUEST 1
+#define NET_WAIT_HEADER 2
+#define NET_WAIT_SEND 3
+
+/* a batch of pipelined requests ends after this many requests... */
+#define NET_PIPELINE_MAX_REQUESTS 16
+
+/* ...or once this many bytes of output are queued */
+#define NET_PIPELINE_MAX_OUTPUT (64 * 1024)
+
+/* results of _net_select_range() */
+#define NET_RANGE_NONE 0
+#define NET_RANGE_PARTIAL 1
+#define NET_RANGE_UNSATISFIABLE 2
+
+/* results of _net_request_body() */
+#define NET_BODY_NONE 0
+#define NET_BODY_PRESENT 1
+#define NET_BODY_INVALID 2
+
+/* range positions are not parsed beyond this (no file is that large) */
+#define NET_MAX_RANGE_VALUE (1LL << 53)
+
+/* the io_uring engine wakes up at least this often (milliseconds) */
+#define NET_RING_MAX_TICK 1000
+
+/* size of the io_uring submission queue */
+#define NET_RING_ENTRIES 1024
+
+/* number of accepts the io_uring engine keeps in flight */
+#define NET_RING_ACCEPTS 16
+
+/* operations of the io_uring engine, kept in the low byte of the user data
+ * of their completions (the fd, or the slot of an accept, is kept above) */
+#define NET_OP_ACCEPT 1
+#define NET_OP_RECV 2
+#define NET_OP_SEND 3
+#define NET_OP_SPLICE_IN 4
+#define NET_OP_SPLICE_OUT 5
+#define NET_OP_CLOSE 6
+#define NET_OP_TICK 7
+#define NET_OP_INDEX 8
+
+/* bytes of a file moved through a connection's pipe at once (pipe size) */
+#define NET_RING_SPLICE_CHUNK (64 * 1024)
+
+/* maximum number of memory segments gathered into one sendmsg() */
+#define NET_RING_MAX_IOV 16
+
+/* size of the buffer the metrics report is written into */
+#define NET_STATS_SIZE 4096
 
 /**************************** Local variables ********************************/
 
@@ -82,11 +241,71 @@ BOOL _net_stop_main_loop;
 /* the listening socket */
 int _net_listening_socket;
 
+/* length of its queue of connections waiting to be accepted */
+int _net_backlog = NET_DEFAULT_BACKLOG;
+
+/* BOOL indicating that connections may be waiting to be accepted */
+BOOL _net_accept_pending;
+
+/* the fd reporting changes to the file index, or -1 */
+int _net_index_fd;
+
+/* the epoll instance all sockets are registered with */
+int _net_epoll_fd;
+
+/* the deadlines of all connections */
+struct tmr_wheel _net_timers;
+
+/* the time the current events are handled at, see tmr_now() */
+uint64_t _net_now;
+
+/* whether the io_uring engine was asked for, and whether it is used */
+BOOL _net_ring_requested;
+BOOL _net_ring_active;
+
+/* the path the metrics are served at, or NULL */
+const char* _net_stats_path;
+
+/* the io_uring of the io_uring engine */
+struct ior_ring _net_ring;
+
+/* the addresses of the clients accepted by the io_uring engine, one per
+ * accept in flight */
+struct sockaddr_in _net_ring_clients[NET_RING_ACCEPTS];
+socklen_t _net_ring_client_lens[NET_RING_ACCEPTS];
+
+/* interval of the io_uring engine's wake-up for deadlines */
+struct __kernel_timespec _net_ring_tick;
+
 /**************************** Module interface *******************************/
 
+void net_use_io_uring(BOOL enabled)
+{
+	_net_ring_requested = enabled;
+}
+
+void net_set_stats_path(const char* path)
+{
+	_net_stats_path = path;
+}
+
+void net_set_backlog(int backlog)
+{
+	_net_backlog = (backlog > 0) ? backlog : NET_DEFAULT_BACKLOG;
+}
+
 int net_start_up(int port)
 {
 	_net_stop_main_loop = FALSE;
+	_net_accept_pending = FALSE;
+	_net_ring_active = FALSE;
+
+	// Serialize the headers of the error pages once
+	_net_prepare_error_page(&_net_400_page);
+	_net_prepare_error_page(&_net_401_page);
+	_net_prepare_error_page(&_net_404_page);
+	_net_prepare_error_page(&_net_500_page);
+	_net_prepare_error_page(&_net_501_page);
 
 	// Create the socket
 	_net_listening_socket = socket(PF_INET, SOCK_STREAM, 0);
@@ -96,6 +315,16 @@ int net_start_up(int port)
 		return NET_SOCKET_ERROR;
 	}
 
+	// Every worker binds its own socket to the same port; the kernel
+	// distributes incoming connections among them.
+	int on = 1;
+	if((setsockopt(_net_listening_socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) ||
+		(setsockopt(_net_listening_socket, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0))
+	{
+		fprintf(stderr, "Error: Could not set socket options.\n");
+		return NET_SOCKET_ERROR;
+	}
+
 	// Build a sockaddr
 	struct sockaddr_in sAddr;
 	memset(&sAddr, 0, sizeof(struct sockaddr_in));
@@ -111,37 +340,118 @@ int net_start_up(int port)
 	}
 
 	// Listen
-	if(listen(_net_listening_socket, 5) < 0)
+	if(listen(_net_listening_socket, _net_backlog) < 0)
 	{
 		fprintf(stderr, "Error: Could not listen on port 80.\n");
 		return NET_LISTEN_ERROR;
 	}
 
+	// Changes to the www tree are reported through this fd (if it is indexed)
+	_net_index_fd = res_get_index_fd();
+
+	// The io_uring engine needs neither epoll nor non-blocking sockets
+	if((_net_ring_requested == TRUE) && (_net_ring_start_up() == TRUE))
+		return NET_OK;
+
+	// The listening socket is edge-triggered, so accept() must never block.
+	if(_net_set_nonblocking(_net_listening_socket) == FALSE)
+	{
+		fprintf(stderr, "Error: Could not set listening socket to non-blocking mode.\n");
+		return NET_SOCKET_ERROR;
+	}
+
+	// Create the epoll instance and register the listening socket
+	_net_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(_net_epoll_fd < 0)
+	{
+		fprintf(stderr, "Error: Could not create epoll instance.\n");
+		return NET_EPOLL_ERROR;
+	}
+
+	if(_net_watch(_net_listening_socket, EPOLLIN | EPOLLET) == FALSE)
+	{
+		fprintf(stderr, "Error: Could not register listening socket with epoll.\n");
+		return NET_EPOLL_ERROR;
+	}
+
+	if((_net_index_fd >= 0) && (_net_watch(_net_index_fd, EPOLLIN | EPOLLET) == FALSE))
+	{
+		fprintf(stderr, "Error: Could not register file index with epoll.\n");
+		return NET_EPOLL_ERROR;
+	}
+
 	return NET_OK;
 }
 
 void net_main_loop()
 {
-	fd_set fds;
+	struct epoll_event events[NET_MAX_EVENTS];
+	_net_now = tmr_now();
+	tmr_init(&_net_timers, _net_now);
+
+	if(_net_ring_active == TRUE)
+	{
+		_net_ring_main_loop();
+		return;
+	}
 
 	while(_net_stop_main_loop == FALSE)
 	{
-		// Select
-		if(_net_select(&fds) == FALSE)
+		// Wait for readiness
+		int numEvents = _net_wait(events, NET_MAX_EVENTS);
+		if(numEvents < 0)
 		{
 			_net_stop_main_loop = TRUE;
 			break;
 		}
+		_net_now = tmr_now();
+
+		int i;
+		for(i = 0; i < numEvents; ++i)
+		{
+			int fd = events[i].data.fd;
+			if(fd == _net_listening_socket)
+			{
+				// Accept incoming connections below
+				_net_accept_pending = TRUE;
+			}
+			else if(fd == _net_index_fd)
+			{
+				// Apply changes to the www tree
+				res_update_index();
+			}
+			else
+			{
+				// Handle HTTP requests and pending responses
+				_net_handle_event(fd, events[i].events);
+
+				// Move its deadline, unless it has been closed
+				struct cls_connection* conn = cls_lookup(fd);
+				if(conn != NULL)
+					_net_update_timeout(conn);
+			}
+		}
 
-		// Handle incoming connections
-		_net_accept_connections(&fds);
+		// Accept incoming connections, a burst of them in portions
+		if(_net_accept_pending == TRUE)
+			_net_accept_pending = _net_accept_connections();
 
-		// Handle HTTP request
-		_net_read_http_requests(&fds);
+		// Close the connections which have missed their deadline
+		_net_expire_timeouts();
 	}
 
-	// Close the listening socket
+	// Close all connections, the listening socket and the epoll instance
+	int slot;
+	for(slot = 0; slot < cls_get_capacity(); ++slot)
+	{
+		struct cls_connection* conn = cls_get(slot);
+		if(conn != NULL)
+			_net_close_connection(conn->socketFd);
+	}
 	close(_net_listening_socket);
+	close(_net_epoll_fd);
+
+	cls_clean_up();
 }
 
 void net_exit()
@@ -152,277 +462,1454 @@ void net_exit()
 /**************************** Local methods **********************************/
 
 /*
- * Selects on the fd_set. Returns TRUE if select was successful, and FALSE
- * if select was interrupted (SIGINT) or failed.
+ * Waits for events on the registered sockets. Returns the number of events
+ * written to 'events', or -1 if epoll_wait was interrupted (SIGINT) or failed.
  */
-BOOL _net_select(fd_set* fds)
+int _net_wait(struct epoll_event* events, int maxEvents)
 {
-	// Clear the fd set
-	FD_ZERO(fds);
+	// Wake up for the next deadline, or only poll if connections are
+	// waiting to be accepted
+	int timeout = (_net_accept_pending == TRUE) ? 0 : tmr_next_timeout(&_net_timers, tmr_now());
+
+	int numEvents = epoll_wait(_net_epoll_fd, events, maxEvents, timeout);
+	if(numEvents == -1)
+	{
+		if(errno != EINTR)
+		{
+			// Do not print this line in case of a signal as the signal handler takes care of it.
+			fprintf(stderr, "Error: Could not wait on epoll instance.\n");
+		}
+	}
+	return numEvents;
+}
 
-	// Mark interesting fds
-	FD_SET(_net_listening_socket, fds);
-	int i;
-	for(i = 0; i < cls_get_length(); ++i)
-		FD_SET(cls_get(i), fds);
+/*
+ * Registers a socket with the epoll instance for 'events'. The
+ * registration persists until the socket is closed.
+ */
+BOOL _net_watch(int fd, uint32_t events)
+{
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(struct epoll_event));
+	ev.events = events;
+	ev.data.fd = fd;
 
-	// Determine highest fd number
-	int maxFd = cls_get_max();
-	if(maxFd == CLS_NO_SUCH_ELEMENT)
-		maxFd = _net_listening_socket;
+	return (epoll_ctl(_net_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0) ? TRUE : FALSE;
+}
 
-	// Select
-	if(select(maxFd + 1, fds, NULL, NULL, NULL) == -1)
-	{
-        if(errno != EINTR)
-        {
-        	// Do not print this line in case of a signal as the signal handler takes care of it.
-        	fprintf(stderr, "Error: Could not select on socket.\n");
-        }
+/*
+ * Switches a file descriptor to non-blocking mode.
+ */
+BOOL _net_set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	if(flags < 0)
 		return FALSE;
-	}
-	else
+
+	return (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0) ? TRUE : FALSE;
+}
+
+/*
+ * Accepts incoming connections and adds them to the connection table. As the
+ * listening socket is edge-triggered, the accept queue is drained, but at
+ * most NET_MAX_ACCEPTS connections are accepted at once.
+ * Returns TRUE if more connections may be waiting.
+ */
+BOOL _net_accept_connections()
+{
+	int accepted;
+	for(accepted = 0; accepted < NET_MAX_ACCEPTS; ++accepted)
 	{
-		return TRUE;
+		// Client sockets are edge-triggered, too, and must never block.
+		struct sockaddr_in client;
+		socklen_t clientLen = sizeof(client);
+		int connection_socket = accept4(_net_listening_socket, (struct sockaddr*) &client, &clientLen,
+				SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if(connection_socket < 0)
+		{
+			if((errno == EINTR) || (errno == ECONNABORTED))
+				continue;
+			if((errno != EAGAIN) && (errno != EWOULDBLOCK))
+				fprintf(stderr, "Error: Could not accept connection.\n");
+			return FALSE;
+		}
+
+		// Responses are written in whole, so there is nothing to gain from
+		// Nagle's algorithm; it would only delay the last segment.
+		int on = 1;
+		setsockopt(connection_socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+		// Add the connection to the connection table
+		struct cls_connection* conn = cls_add(connection_socket);
+		if(conn == NULL)
+		{
+			fprintf(stderr, "Error: Out of memory.\n");
+			close(connection_socket);
+			continue;
+		}
+		conn->clientAddr = client.sin_addr.s_addr;
+		req_init(&conn->parser);
+		oq_init(&conn->out);
+
+		// Watch for both directions once; with edge-triggering there is no
+		// need to switch interest when output is pending.
+		if(_net_watch(connection_socket, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET) == FALSE)
+		{
+			fprintf(stderr, "Error: Could not register connection with epoll.\n");
+			cls_remove(connection_socket);
+			close(connection_socket);
+			continue;
+		}
+		_net_set_timeout(conn, NET_WAIT_REQUEST);
+		met_count_accept();
 	}
+
+	return TRUE;
 }
 
 /*
- * Accepts incoming connections and adds them to the clientlist.
+ * Reacts on events of a client socket: continues sending pending
+ * responses if the socket became writable and reads new requests.
  */
-void _net_accept_connections(fd_set* fds)
+void _net_handle_event(int socket, uint32_t events)
 {
-	if(FD_ISSET(_net_listening_socket, fds))
+	struct cls_connection* conn = cls_lookup(socket);
+	if(conn == NULL)
+		return;
+
+	if((events & EPOLLOUT) && (oq_is_empty(&conn->out) == FALSE))
 	{
-	    int connection_socket = accept(_net_listening_socket, NULL, NULL);
+		if(_net_flush_output(conn) == FALSE)
+			return;
+
+		// Resume reading requests held back while the output was pending
+		if((conn->inputBlocked == TRUE) && (oq_is_empty(&conn->out) == TRUE))
+		{
+			_net_handle_input(conn);
+			return;
+		}
+
+		// Idle once the last response is out, see _net_handle_input()
+		if(oq_is_empty(&conn->out) == TRUE)
+			oq_clear(&conn->out);
+	}
+
+	if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+	{
+		if(conn->closeAfterFlush == TRUE)
+			return;
+
+		if(oq_is_empty(&conn->out) == FALSE)
+		{
+			// Answer requests in order; read once the output is drained.
+			conn->inputBlocked = TRUE;
+			return;
+		}
 
-	    if(connection_socket < 0)
-	    {
-	    	fprintf(stderr, "Error: Could not accept connection.\n");
-	    }
-	    else
-	    {
-	    	// Push back the fd to the list
-	    	cls_add(connection_socket);
-	    }
+		_net_handle_input(conn);
 	}
 }
 
 /*
- * Reads data from any (client) socket which has data to read.
+ * Reads from a client socket which has data to read and answers all
+ * requests that are complete. Partial requests stay in the connection's
+ * receive buffer until the rest arrives. Reading stops while a response
+ * is waiting for the socket to become writable.
  */
-void _net_read_http_requests(fd_set* fds)
+void _net_handle_input(struct cls_connection* conn)
 {
-	int i;
-	for(i = 0; i < cls_get_length(); ++i)
+	int socket = conn->socketFd;
+	conn->inputBlocked = FALSE;
+
+	while(TRUE)
 	{
-		int curFd = cls_get(i);
-		if(FD_ISSET(curFd, fds))
+		// The socket is edge-triggered, so read until there is nothing left.
+		int readRet = _net_fill_input_buffer(conn);
+		if(readRet == NET_READ_CLOSED)
 		{
-			char buffer[200];
-			memset(buffer, 0, 200);
+			_net_close_connection(socket);
+			return;
+		}
 
-			int bytesRead = read(curFd, buffer, 199);
-			if(bytesRead > 0)
-			{
-				// Handle the http request and send a reply.
-				_net_handle_http_request(buffer, curFd);
-			}
-			// else read error. Do nothing.
+		// Answer the requests received so far
+		if(_net_process_input(conn) == FALSE)
+			return;
+
+		if(readRet == NET_READ_EOF)
+		{
+			// The client has sent all its requests. Close once the answers
+			// have been sent; requests held back by the pipeline limits are
+			// answered first, which reads the end of file once more.
+			if(oq_is_empty(&conn->out) == TRUE)
+				_net_close_connection(socket);
+			else if(conn->inLen == 0)
+				conn->closeAfterFlush = TRUE;
+			else
+				conn->inputBlocked = TRUE;
+			return;
+		}
+
+		if(oq_is_empty(&conn->out) == FALSE)
+		{
+			// Continue once the response has been sent
+			conn->inputBlocked = TRUE;
+			return;
+		}
 
-			// Close the socket.
-			close(curFd);
-			// Remove it from the client list.
-			cls_remove(curFd);
+		if(readRet == NET_READ_DRAINED)
+		{
+			// Idle until the next request. The output queue keeps a chunk
+			// of memory between batches, which goes back to the pool now.
+			oq_clear(&conn->out);
+			return;
+		}
+
+		// The buffer was full. If no request could be taken out of it, the
+		// request is too large.
+		if(conn->inLen == NET_MAX_REQUEST_SIZE)
+		{
+			_net_queue_error_page(conn, &_net_400_page, FALSE, FALSE);
+			_net_flush_output(conn);
+			return;
 		}
 	}
 }
 
 /*
- * Reacts on a HTTP request (parsing, sending a specific answer)
+ * Reads from a client socket into its receive buffer until the socket is
+ * drained or the buffer has reached NET_MAX_REQUEST_SIZE. Returns
+ * NET_READ_DRAINED, NET_READ_FULL, NET_READ_EOF if the client has shut
+ * down its side of the connection, or NET_READ_CLOSED if reading failed.
  */
-void _net_handle_http_request(char* request, int socket)
+int _net_fill_input_buffer(struct cls_connection* conn)
 {
-	char *resPath = _net_get_resource_path(request);
-	if(resPath == NULL)
+	for(;;)
 	{
-		// The request could not be parsed.
-		_net_send_error_page(&_net_400_page, socket);
-		return;
-	}
+		// Grow the buffer if necessary
+		if(conn->inLen == conn->inCap)
+		{
+			if(conn->inCap == NET_MAX_REQUEST_SIZE)
+				return NET_READ_FULL;
+			if(_net_grow_input_buffer(conn) == FALSE)
+				return NET_READ_CLOSED;
+		}
 
-	struct res_resource resinfo;
-	int lookupRet = res_lookup(resPath, &resinfo);
+		ssize_t bytesRead = recv(conn->socketFd, &conn->inBuf[conn->inLen],
+				conn->inCap - conn->inLen, 0);
+		if(bytesRead < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return NET_READ_DRAINED;
 
-	// TODO: Somehow, RES_xxx do not work inside a switch statement.
-	// gcc says:
-	// "error: case label does not reduce to an integer constant"
+			// Read error.
+			return NET_READ_CLOSED;
+		}
+		else if(bytesRead == 0)
+		{
+			// The client closed the connection, but may still wait for the
+			// answers to what it has sent
+			return NET_READ_EOF;
+		}
 
-	if(lookupRet == RES_OK)
-	{
-		_net_send_resource(&resinfo, socket);
-		fclose(resinfo.file);
+		conn->inLen += bytesRead;
+		conn->lastRead = met_now();
 	}
-	else if(lookupRet == RES_FILE_NOT_FOUND)
+}
+
+/*
+ * Doubles the size of a connection's receive buffer, up to
+ * NET_MAX_REQUEST_SIZE. The buffers are taken from the pool and the old one
+ * is given back. Returns FALSE if out of memory.
+ */
+BOOL _net_grow_input_buffer(struct cls_connection* conn)
+{
+	size_t newCap = (conn->inCap == 0) ? NET_INPUT_BUFFER_SIZE : conn->inCap * 2;
+	if(newCap > NET_MAX_REQUEST_SIZE)
+		newCap = NET_MAX_REQUEST_SIZE;
+
+	char* newBuf = mp_get(newCap);
+	if(newBuf == NULL)
 	{
-		_net_send_error_page(&_net_404_page, socket);
+		fprintf(stderr, "Error: Out of memory.\n");
+		return FALSE;
 	}
-	else if((lookupRet == RES_INVALID_PATH) || (lookupRet == RES_ACCESS_DENIED))
+	if(conn->inBuf != NULL)
 	{
-		// resPath contained '..'
-		_net_send_error_page(&_net_401_page, socket);
+		memcpy(newBuf, conn->inBuf, conn->inLen);
+		mp_put(conn->inBuf, conn->inCap);
 	}
-	else
+	conn->inBuf = newBuf;
+	conn->inCap = newCap;
+	return TRUE;
+}
+
+/*
+ * Parses the receive buffer and answers the complete requests in it.
+ * Pipelined requests are answered in batches: the responses to a batch are
+ * queued and then sent with a single gathered write. The next batch is
+ * only handled once the previous responses have been written completely.
+ * Returns FALSE if the connection has been closed or is about to be closed.
+ */
+BOOL _net_process_input(struct cls_connection* conn)
+{
+	while((conn->inLen > 0) && (oq_is_empty(&conn->out) == TRUE))
 	{
-		/*
-		 * RES_IO_ERROR
-		 * RES_UNKNOWN_FILE_TYPE
-		 */
-		_net_send_error_page(&_net_500_page, socket);
+		BOOL more = _net_queue_responses(conn);
+
+		// Send as much of the replies as the socket takes right now
+		if((_net_flush_output(conn) == FALSE) || (conn->closeAfterFlush == TRUE))
+			return FALSE;
+
+		if(more == FALSE)
+			break;
 	}
+
+	return TRUE;
 }
 
 /*
- * Extracts the resource path from a HTTP request
+ * Queues the responses to the complete requests in the receive buffer,
+ * up to NET_PIPELINE_MAX_REQUESTS requests or NET_PIPELINE_MAX_OUTPUT bytes
+ * of output, and removes the requests from the buffer. Returns TRUE if the
+ * batch ended at one of these limits, i.e. more requests may be waiting.
  */
-char* _net_get_resource_path(char* request)
+BOOL _net_queue_responses(struct cls_connection* conn)
 {
-	int reqLen = strlen(request);
-	int pos = 0;
+	BOOL more = FALSE;
+	int handled = 0;
 
-	// Skip the first word
-	while(request[pos] != ' ')
+	while((conn->inStart < conn->inLen) && (conn->closeAfterFlush == FALSE))
 	{
-		if(++pos == reqLen)
-			return NULL;
-	}
+		if((handled == NET_PIPELINE_MAX_REQUESTS) || (conn->out.length >= NET_PIPELINE_MAX_OUTPUT))
+		{
+			more = TRUE;
+			break;
+		}
 
-	// Skip any following white space just in case...
-	while(request[pos] == ' ')
-	{
-		if(++pos == reqLen)
-			return NULL;
+		int parseRet = req_parse(&conn->parser, _net_request(conn), conn->inLen - conn->inStart);
+		if(parseRet == REQ_INCOMPLETE)
+			break;
+
+		if(parseRet == REQ_BAD_REQUEST)
+		{
+			// Answered after the responses queued so far
+			_net_queue_error_page(conn, &_net_400_page, FALSE, FALSE);
+			break;
+		}
+
+		// Request bodies are not read. Rather than skipping them, which
+		// would take a decoder for chunked ones, the connection is closed
+		// after the response, so a body is never taken for a request.
+		int body = _net_request_body(conn);
+		if(body == NET_BODY_INVALID)
+		{
+			_net_queue_error_page(conn, &_net_400_page, FALSE, FALSE);
+			break;
+		}
+
+		++conn->requests;
+		BOOL keepAlive = req_keep_alive(&conn->parser) && (body == NET_BODY_NONE) &&
+				(conn->requests < NET_KEEP_ALIVE_MAX_REQUESTS);
+
+		// Handle the http request and queue a reply.
+		_net_handle_http_request(conn, keepAlive);
+		++handled;
+
+		// Continue behind the request
+		conn->inStart += conn->parser.length;
+		req_init(&conn->parser);
 	}
 
-	// Go to the next white space or line end
-	int endPos = pos;
-	while((request[endPos] != ' ') && (request[endPos] != '\n') && (request[endPos] != '\r'))
+	// Remove the handled requests from the buffer at once. The parser's
+	// offsets are relative to inStart, so a partial request stays valid.
+	if(conn->inStart > 0)
 	{
-		if(++endPos == reqLen)
-			return NULL;
+		memmove(conn->inBuf, &conn->inBuf[conn->inStart], conn->inLen - conn->inStart);
+		conn->inLen -= conn->inStart;
+		conn->inStart = 0;
 	}
 
-	// Set an end mark right behind the resource path
-	request[endPos] = '\0';
+	return more;
+}
 
-	return &request[pos];
+/*
+ * Tells from the Transfer-Encoding and Content-Length headers of the
+ * parsed request whether a body follows it. Returns NET_BODY_NONE,
+ * NET_BODY_PRESENT or NET_BODY_INVALID if the Content-Length is not a
+ * number.
+ */
+int _net_request_body(struct cls_connection* conn)
+{
+	size_t len;
+	if(req_get_header(&conn->parser, _net_request(conn), REQ_HEADER_TRANSFER_ENCODING, &len) != NULL)
+		return NET_BODY_PRESENT;
+
+	const char* value = req_get_header(&conn->parser, _net_request(conn), REQ_HEADER_CONTENT_LENGTH, &len);
+	if(value == NULL)
+		return NET_BODY_NONE;
+	if(len == 0)
+		return NET_BODY_INVALID;
+
+	BOOL empty = TRUE;
+	size_t i;
+	for(i = 0; i < len; ++i)
+	{
+		if((value[i] < '0') || (value[i] > '9'))
+			return NET_BODY_INVALID;
+		if(value[i] != '0')
+			empty = FALSE;
+	}
+	return (empty == TRUE) ? NET_BODY_NONE : NET_BODY_PRESENT;
 }
 
 /*
- * Sends a res_resource to the client.
+ * Returns the start of the request being parsed or handled, which the
+ * parser's offsets are relative to.
  */
-void _net_send_resource(struct res_resource* resinfo, int socket)
+char* _net_request(struct cls_connection* conn)
 {
-	// Generate header
-	char *header = _net_generate_header("200 OK", resinfo->len, resinfo->mime);
-	int headerLen = strlen(header);
+	return &conn->inBuf[conn->inStart];
+}
 
-	// Send header
-	ssize_t bytesSent = send(socket, header, headerLen, 0);
-	free(header);
+/*
+ * Writes pending output to the client. Closes the connection if writing
+ * fails, or if it is done and the connection is not kept alive.
+ * Returns FALSE if the connection has been closed.
+ */
+BOOL _net_flush_output(struct cls_connection* conn)
+{
+	off_t pending = conn->out.length;
+	int flushRet = oq_flush(&conn->out, conn->socketFd);
 
-	if(bytesSent != headerLen)
+	if(conn->out.length != pending)
 	{
-		fprintf(stderr, "Error: Could not send to socket.");
-		net_exit();
-		return;
+		// The client makes progress, give it time for the rest
+		if(flushRet != OQ_DONE)
+			_net_set_timeout(conn, NET_WAIT_SEND);
+		met_count_bytes(pending - conn->out.length);
 	}
 
-	// Create buffer large enough to contain the whole file
-	char *buf = malloc(sizeof(char) * resinfo->len);
-	if(buf == NULL)
+	if((flushRet == OQ_ERROR) || ((flushRet == OQ_DONE) && (conn->closeAfterFlush == TRUE)))
 	{
-		fprintf(stderr, "Error: Out of memory.\n");
-		net_exit();
-		return;
+		_net_close_connection(conn->socketFd);
+		return FALSE;
 	}
 
-	// Read file
-	size_t bytesRead = fread(buf, 1, resinfo->len, resinfo->file);
-	if(bytesRead != resinfo->len)
+	return TRUE;
+}
+
+/*
+ * Removes a connection from the connection table and closes its socket.
+ * Unsent output is dropped.
+ */
+void _net_close_connection(int socket)
+{
+	struct cls_connection* conn = cls_lookup(socket);
+
+	// Operations in flight have to complete first
+	if(_net_ring_active == TRUE)
 	{
-		fprintf(stderr, "Error: Could not read from file.\n");
-		net_exit();
+		if(conn != NULL)
+			_net_ring_close(conn);
+		return;
 	}
-	else
+
+	if(conn != NULL)
 	{
-		// Send content
-		bytesSent = send(socket, buf, resinfo->len, 0);
-		if(bytesSent != resinfo->len)
-		{
-			net_exit();
-		}
+		tmr_cancel(&_net_timers, &conn->timer);
+		oq_clear(&conn->out);
+		mp_put(conn->inBuf, conn->inCap);
+		met_count_close();
 	}
 
-	free(buf);
+	// Remove it from the connection table.
+	cls_remove(socket);
+	// Close the socket. This also removes it from the epoll instance.
+	close(socket);
 }
 
 /*
- * Sends an error page to the client.
+ * Closes the connections which have missed their deadline.
  */
-void _net_send_error_page(const struct _net_html_error_page* error, int socket)
+void _net_expire_timeouts()
 {
-	int contentLen = strlen(error->content);
-
-	// Generate header
-	char *header = _net_generate_header(error->msg, contentLen, "text/html");
-	int headerLen = strlen(header);
-
-	// Send header
-	ssize_t bytesSent = send(socket, header, headerLen, 0);
-	free(header);
-
-	if(bytesSent != headerLen)
+	struct tmr_timer* timer;
+	while((timer = tmr_expire(&_net_timers, _net_now)) != NULL)
 	{
-		fprintf(stderr, "Error: Could not send to socket.");
-		net_exit();
-		return;
+		struct cls_connection* conn = (struct cls_connection*) ((char*) timer - offsetof(struct cls_connection, timer));
+		_net_close_connection(conn->socketFd);
 	}
+}
 
-	// Send content
-	bytesSent = send(socket, error->content, contentLen, 0);
+/*
+ * Sets a connection's deadline according to what it is waiting for: output
+ * to be sent, the rest of a request or the next request. The deadline is
+ * only moved when this changes or a request has been handled, so a client
+ * cannot keep a connection open by sending a request byte by byte.
+ */
+void _net_update_timeout(struct cls_connection* conn)
+{
+	int timeout = NET_WAIT_REQUEST;
+	if((oq_is_empty(&conn->out) == FALSE) || (conn->pipeBytes > 0))
+		timeout = NET_WAIT_SEND;
+	else if(conn->inLen > 0)
+		timeout = NET_WAIT_HEADER;
+
+	// A response sent right away leaves the connection waiting for the
+	// next request, as it was before; it starts a new wait all the same
+	if((timeout != conn->timeout) || (conn->requests != conn->timedRequests))
+		_net_set_timeout(conn, timeout);
+}
 
-	if(bytesSent != contentLen)
-	{
-		fprintf(stderr, "Error: Could not send to socket.");
-		net_exit();
-	}
+/*
+ * Sets a connection's deadline for 'timeout' (NET_WAIT_xxx), counting
+ * from now.
+ */
+void _net_set_timeout(struct cls_connection* conn, int timeout)
+{
+	uint64_t delay = NET_KEEP_ALIVE_TIMEOUT;
+	if(timeout == NET_WAIT_HEADER)
+		delay = NET_HEADER_TIMEOUT;
+	else if(timeout == NET_WAIT_SEND)
+		delay = NET_SEND_TIMEOUT;
+
+	conn->timeout = timeout;
+	conn->timedRequests = conn->requests;
+	tmr_schedule(&_net_timers, &conn->timer, _net_now + delay);
 }
 
 /*
- * Generates a HTTP header including newline. Has to be free'd afterwards.
+ * Reacts on the parsed HTTP request at the start of the connection's
+ * receive buffer (queueing a specific answer). If keepAlive is FALSE, the
+ * connection is closed once the answer has been sent.
  */
-char* _net_generate_header(const char* status, int len, const char* mime)
+void _net_handle_http_request(struct cls_connection* conn, BOOL keepAlive)
 {
-	char *header = malloc(sizeof(char) * 200);
-	memset(header, 0, 200);
+	// Responses to HEAD are those to GET without the body
+	BOOL head = (conn->parser.method == REQ_METHOD_HEAD) ? TRUE : FALSE;
+	if((conn->parser.method != REQ_METHOD_GET) && (head == FALSE))
+	{
+		// Other methods may come with any kind of body, so the connection
+		// is closed rather than risking to read part of it as a request
+		_net_queue_error_page(conn, &_net_501_page, FALSE, FALSE);
+		return;
+	}
 
-	strcpy(header, "HTTP/1.0 ");
-	strcat(header, status);
-	strcat(header, "\n");
+	// Set an end mark right behind the resource path for the lookup. The
+	// request is complete, so this only overwrites the delimiter, which is
+	// put back for the access log.
+	char* resPath = &_net_request(conn)[conn->parser.pathOff];
+	char delimiter = resPath[conn->parser.pathLen];
+	resPath[conn->parser.pathLen] = '\0';
 
-	strcat(header, "Content-Length: ");
-	char lenStr[10];
-	sprintf(lenStr, "%i", len);
-	strcat(header, lenStr);
-	strcat(header, "\n");
+	if((_net_stats_path != NULL) && (strcmp(resPath, _net_stats_path) == 0))
+	{
+		resPath[conn->parser.pathLen] = delimiter;
+		_net_queue_stats(conn, keepAlive, head);
+		return;
+	}
 
-	strcat(header, "Content-Type: ");
-	strcat(header, mime);
-	strcat(header, "\n");
+	struct res_resource resinfo;
+	int lookupRet = res_lookup(resPath, conn->parser.acceptGzip, &resinfo);
+	resPath[conn->parser.pathLen] = delimiter;
 
-	// Empty line
-	strcat(header, "\n");
+	// TODO: Somehow, RES_xxx do not work inside a switch statement.
+	// gcc says:
+	// "error: case label does not reduce to an integer constant"
 
-	return header;
+	if(lookupRet == RES_OK)
+	{
+		// The queue takes over the resource
+		_net_queue_resource(conn, &resinfo, keepAlive, head);
+	}
+	else if(lookupRet == RES_FILE_NOT_FOUND)
+	{
+		_net_queue_error_page(conn, &_net_404_page, keepAlive, head);
+	}
+	else if((lookupRet == RES_INVALID_PATH) || (lookupRet == RES_ACCESS_DENIED))
+	{
+		// resPath contained '..'
+		_net_queue_error_page(conn, &_net_401_page, keepAlive, head);
+	}
+	else
+	{
+		/*
+		 * RES_IO_ERROR
+		 * RES_UNKNOWN_FILE_TYPE
+		 */
+		_net_queue_error_page(conn, &_net_500_page, keepAlive, head);
+	}
+}
+
+/*
+ * Queues a res_resource for sending to the client. The queue takes
+ * over the resource and releases it once it has been sent.
+ *
+ * The response is made up of the static status line, the entity headers
+ * cached with the resource, the static Connection line and the body, so
+ * nothing has to be formatted or allocated, and the output queue sends
+ * header and body with a single gathered write. Responses to HEAD and
+ * 304 responses (the client's copy is still current) have no body; a 304
+ * only repeats the validators at the end of the cached header. Partial
+ * responses replace the cached Content-Length line with their own.
+ */
+void _net_queue_resource(struct cls_connection* conn, struct res_resource* resinfo, BOOL keepAlive, BOOL head)
+{
+	if(keepAlive == FALSE)
+		conn->closeAfterFlush = TRUE;
+
+	// Where the response starts in the queue, in case it has to be dropped
+	struct _oq_segment* mark = conn->out.tail;
+
+	int statusCode = 200;
+	const char* status = _net_status_200;
+	size_t statusLen = sizeof(_net_status_200) - 1;
+	char fields[128]; /* header lines specific to this response */
+	int fieldsLen = 0;
+	size_t headerOff = 0;
+	off_t bodyOff = 0;
+	off_t bodyLen = resinfo->len;
+	BOOL sendBody = (head == FALSE) ? TRUE : FALSE;
+
+	int range = NET_RANGE_NONE;
+	if(_net_not_modified(conn, resinfo) == TRUE)
+	{
+		statusCode = 304;
+		status = _net_status_304;
+		statusLen = sizeof(_net_status_304) - 1;
+		headerOff = resinfo->validatorsOff;
+		sendBody = FALSE;
+	}
+	else
+	{
+		range = _net_select_range(conn, resinfo, &bodyOff, &bodyLen);
+	}
+
+	if(range == NET_RANGE_PARTIAL)
+	{
+		statusCode = 206;
+		status = _net_status_206;
+		statusLen = sizeof(_net_status_206) - 1;
+		fieldsLen = snprintf(fields, sizeof(fields), "Content-Length: %lld\r\nContent-Range: bytes %lld-%lld/%lld\r\n",
+				(long long) bodyLen, (long long) bodyOff, (long long) (bodyOff + bodyLen - 1), (long long) resinfo->len);
+		headerOff = resinfo->typeOff;
+	}
+	else if(range == NET_RANGE_UNSATISFIABLE)
+	{
+		statusCode = 416;
+		status = _net_status_416;
+		statusLen = sizeof(_net_status_416) - 1;
+		fieldsLen = snprintf(fields, sizeof(fields), "Content-Length: 0\r\nContent-Range: bytes */%lld\r\n",
+				(long long) resinfo->len);
+		headerOff = resinfo->validatorsOff;
+		sendBody = FALSE;
+	}
+
+	// Queue header and content. The cached header is released together
+	// with the body, which follows it in the queue, or on its own if there
+	// is no body. Small files are sent from memory, others go straight from
+	// the page cache to the socket.
+	const char* header = &resinfo->header[headerOff];
+	size_t headerLen = resinfo->headerLen - headerOff;
+	int pushRet = oq_push_mem(&conn->out, status, statusLen, NULL, NULL);
+	if((pushRet == OQ_OK) && (fieldsLen > 0))
+		pushRet = oq_push_copy(&conn->out, fields, fieldsLen);
+
+	if(pushRet != OQ_OK)
+	{
+		res_release(resinfo);
+	}
+	else if(sendBody == FALSE)
+	{
+		if((oq_push_mem(&conn->out, header, headerLen, res_release_ref, resinfo->cacheRef) != OQ_OK) ||
+			(_net_queue_header_end(conn, keepAlive) == FALSE))
+			pushRet = OQ_OUT_OF_MEMORY;
+	}
+	else if((oq_push_mem(&conn->out, header, headerLen, NULL, NULL) == OQ_OK) &&
+		(_net_queue_header_end(conn, keepAlive) == TRUE))
+	{
+		if(resinfo->data != NULL)
+			pushRet = oq_push_mem(&conn->out, &resinfo->data[bodyOff], bodyLen, res_release_ref, resinfo->cacheRef);
+		else
+			pushRet = oq_push_file(&conn->out, resinfo->fd, bodyOff, bodyLen, res_release_ref, resinfo->cacheRef);
+	}
+	else
+	{
+		res_release(resinfo);
+		pushRet = OQ_OUT_OF_MEMORY;
+	}
+
+	if(pushRet != OQ_OK)
+	{
+		// Drop the incomplete response, it may refer to the released header.
+		// The responses to earlier requests are still sent.
+		fprintf(stderr, "Error: Out of memory.\n");
+		oq_truncate(&conn->out, mark);
+		_net_queue_error_page(conn, &_net_500_page, FALSE, head);
+		return;
+	}
+
+	_net_count_response(conn, statusCode, (sendBody == TRUE) ? bodyLen : 0);
+}
+
+/*
+ * Works out which part of a resource is sent for the request's Range
+ * header. Only single byte ranges are served; requests for several ranges
+ * get the whole resource, as do malformed ranges and ranges whose
+ * If-Range condition fails (RFC 7233). On NET_RANGE_PARTIAL, 'offset' and
+ * 'len' are set to the range.
+ */
+int _net_select_range(struct cls_connection* conn, const struct res_resource* resinfo, off_t* offset, off_t* len)
+{
+	size_t valueLen;
+	const char* value = req_get_header(&conn->parser, _net_request(conn), REQ_HEADER_RANGE, &valueLen);
+	if(value == NULL)
+		return NET_RANGE_NONE;
+
+	// If-Range: only send a part of what the client already has a part of
+	size_t ifRangeLen;
+	const char* ifRange = req_get_header(&conn->parser, _net_request(conn), REQ_HEADER_IF_RANGE, &ifRangeLen);
+	if(ifRange != NULL)
+	{
+		if(conn->parser.ifRangeDate >= 0)
+		{
+			if(conn->parser.ifRangeDate != resinfo->mtime)
+				return NET_RANGE_NONE;
+		}
+		else
+		{
+			// Strong comparison, weak tags never match
+			if((ifRangeLen != resinfo->etagLen) || (memcmp(ifRange, resinfo->etag, resinfo->etagLen) != 0))
+				return NET_RANGE_NONE;
+		}
+	}
+
+	if((valueLen < 7) || (strncmp(value, "bytes=", 6) != 0) || (memchr(value, ',', valueLen) != NULL))
+		return NET_RANGE_NONE;
+
+	// "first-last", "first-" or "-suffixLength"
+	size_t pos = 6;
+	long long first = -1;
+	long long last = -1;
+	if(value[pos] != '-')
+	{
+		first = 0;
+		while((pos < valueLen) && (value[pos] >= '0') && (value[pos] <= '9') && (first <= NET_MAX_RANGE_VALUE))
+			first = first * 10 + (value[pos++] - '0');
+	}
+	if((pos == valueLen) || (value[pos] != '-'))
+		return NET_RANGE_NONE;
+	++pos;
+	if(pos < valueLen)
+	{
+		last = 0;
+		while((pos < valueLen) && (value[pos] >= '0') && (value[pos] <= '9') && (last <= NET_MAX_RANGE_VALUE))
+			last = last * 10 + (value[pos++] - '0');
+	}
+	if((pos != valueLen) || ((first < 0) && (last < 0)) || ((first >= 0) && (last >= 0) && (last < first)))
+		return NET_RANGE_NONE;
+
+	if(first < 0)
+	{
+		// The last 'last' bytes
+		if((last == 0) || (resinfo->len == 0))
+			return NET_RANGE_UNSATISFIABLE;
+		first = (last < resinfo->len) ? resinfo->len - last : 0;
+		last = resinfo->len - 1;
+	}
+	else
+	{
+		if(first >= resinfo->len)
+			return NET_RANGE_UNSATISFIABLE;
+		if((last < 0) || (last >= resinfo->len))
+			last = resinfo->len - 1;
+	}
+
+	*offset = first;
+	*len = last - first + 1;
+	return NET_RANGE_PARTIAL;
+}
+
+/*
+ * Evaluates the request's conditional headers against a resource. Returns
+ * TRUE if the client's copy is current, i.e. If-None-Match lists the
+ * resource's entity tag or, without If-None-Match, the resource has not
+ * been modified since the If-Modified-Since date (RFC 7232, 6).
+ */
+BOOL _net_not_modified(struct cls_connection* conn, const struct res_resource* resinfo)
+{
+	size_t ifNoneMatchLen;
+	const char* ifNoneMatch = req_get_header(&conn->parser, _net_request(conn), REQ_HEADER_IF_NONE_MATCH, &ifNoneMatchLen);
+	if(ifNoneMatch != NULL)
+		return _net_etag_matches(ifNoneMatch, ifNoneMatchLen, resinfo->etag, resinfo->etagLen);
+
+	if(conn->parser.ifModifiedSince >= 0)
+		return (resinfo->mtime <= conn->parser.ifModifiedSince) ? TRUE : FALSE;
+
+	return FALSE;
+}
+
+/*
+ * Checks whether the If-None-Match value 'list' ("*" or a comma-separated
+ * list of entity tags) matches 'etag', using the weak comparison.
+ */
+BOOL _net_etag_matches(const char* list, size_t len, const char* etag, size_t etagLen)
+{
+	size_t pos = 0;
+	while(pos < len)
+	{
+		// Skip separators
+		while((pos < len) && ((list[pos] == ' ') || (list[pos] == '\t') || (list[pos] == ',')))
+			++pos;
+		if(pos == len)
+			break;
+
+		if(list[pos] == '*')
+			return TRUE;
+
+		// Weak tags compare equal to strong ones
+		if((pos + 1 < len) && (list[pos] == 'W') && (list[pos + 1] == '/'))
+			pos += 2;
+
+		// The tag runs up to its closing quote
+		size_t start = pos;
+		if((pos < len) && (list[pos] == '"'))
+		{
+			++pos;
+			while((pos < len) && (list[pos] != '"'))
+				++pos;
+			if(pos < len)
+				++pos;
+		}
+		while((pos < len) && (list[pos] != ',') && (list[pos] != ' ') && (list[pos] != '\t'))
+			++pos;
+
+		if((pos - start == etagLen) && (memcmp(&list[start], etag, etagLen) == 0))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Queues an error page for sending to the client. If 'head' is TRUE, only
+ * its header is sent.
+ */
+void _net_queue_error_page(struct cls_connection* conn, const struct _net_html_error_page* error, BOOL keepAlive, BOOL head)
+{
+	if(keepAlive == FALSE)
+		conn->closeAfterFlush = TRUE;
+
+	// Queue the prepared header and the static content
+	struct _oq_segment* mark = conn->out.tail;
+	if((oq_push_mem(&conn->out, error->header, error->headerLen, NULL, NULL) != OQ_OK) ||
+		(_net_queue_header_end(conn, keepAlive) == FALSE) ||
+		((head == FALSE) && (oq_push_mem(&conn->out, error->content, strlen(error->content), NULL, NULL) != OQ_OK)))
+	{
+		// Send what was queued before, but not a partial page
+		fprintf(stderr, "Error: Out of memory.\n");
+		oq_truncate(&conn->out, mark);
+		conn->closeAfterFlush = TRUE;
+		return;
+	}
+
+	_net_count_response(conn, error->status, (head == FALSE) ? strlen(error->content) : 0);
+}
+
+/*
+ * Queues the metrics report of all workers (as plain text, never to be
+ * cached).
+ */
+void _net_queue_stats(struct cls_connection* conn, BOOL keepAlive, BOOL head)
+{
+	if(keepAlive == FALSE)
+		conn->closeAfterFlush = TRUE;
+
+	// Count this response first, so the report includes it
+	uint64_t latency = met_now() - conn->lastRead;
+	met_count_response(200, latency);
+
+	char body[NET_STATS_SIZE];
+	size_t bodyLen = met_report(body, sizeof(body));
+	_net_log_request(conn, 200, (head == FALSE) ? bodyLen : 0, latency);
+
+	char header[128];
+	int headerLen = _net_generate_header(header, sizeof(header), "200 OK", bodyLen, "text/plain");
+
+	struct _oq_segment* mark = conn->out.tail;
+	if((oq_push_copy(&conn->out, header, headerLen) != OQ_OK) ||
+		(oq_push_mem(&conn->out, _net_no_store, sizeof(_net_no_store) - 1, NULL, NULL) != OQ_OK) ||
+		(_net_queue_header_end(conn, keepAlive) == FALSE) ||
+		((head == FALSE) && (oq_push_copy(&conn->out, body, bodyLen) != OQ_OK)))
+	{
+		fprintf(stderr, "Error: Out of memory.\n");
+		oq_truncate(&conn->out, mark);
+		_net_queue_error_page(conn, &_net_500_page, FALSE, head);
+	}
+}
+
+/*
+ * Counts a response queued on a connection, with the time since the
+ * request was read as its latency, and logs the request.
+ */
+void _net_count_response(struct cls_connection* conn, int status, uint64_t bodyLen)
+{
+	uint64_t latency = met_now() - conn->lastRead;
+	met_count_response(status, latency);
+	_net_log_request(conn, status, bodyLen, latency);
+}
+
+/*
+ * Hands the request being answered on a connection to the access log.
+ */
+void _net_log_request(struct cls_connection* conn, int status, uint64_t bodyLen, uint64_t latency)
+{
+	struct alog_entry entry;
+	entry.clientAddr = conn->clientAddr;
+	entry.status = status;
+	entry.bytes = bodyLen;
+	entry.latency = latency;
+
+	// The parser only knows the length of complete requests
+	if(conn->parser.length > 0)
+	{
+		entry.method = &_net_request(conn)[conn->parser.methodOff];
+		entry.methodLen = conn->parser.methodLen;
+		// The whole target, with the query
+		entry.path = &_net_request(conn)[conn->parser.pathOff];
+		entry.pathLen = conn->parser.pathLen;
+		if(conn->parser.queryOff > 0)
+			entry.pathLen = conn->parser.queryOff + conn->parser.queryLen - conn->parser.pathOff;
+		entry.versionMajor = conn->parser.versionMajor;
+		entry.versionMinor = conn->parser.versionMinor;
+	}
+	else
+	{
+		entry.method = NULL;
+	}
+
+	if(alog_write(&entry) == FALSE)
+		met_count_log_drop();
+}
+
+/*
+ * Queues the Connection header and the empty line ending the header.
+ * Returns FALSE if out of memory.
+ */
+BOOL _net_queue_header_end(struct cls_connection* conn, BOOL keepAlive)
+{
+	int pushRet;
+	if(keepAlive == TRUE)
+		pushRet = oq_push_mem(&conn->out, _net_keep_alive_end, sizeof(_net_keep_alive_end) - 1, NULL, NULL);
+	else
+		pushRet = oq_push_mem(&conn->out, _net_close_end, sizeof(_net_close_end) - 1, NULL, NULL);
+
+	return (pushRet == OQ_OK) ? TRUE : FALSE;
+}
+
+/*
+ * Serializes the status line and entity headers of an error page.
+ */
+void _net_prepare_error_page(struct _net_html_error_page* error)
+{
+	error->headerLen = _net_generate_header(error->header, sizeof(error->header),
+			error->msg, strlen(error->content), "text/html");
+	error->status = atoi(error->msg);
+}
+
+/*
+ * Writes the status line and the Content-Length and Content-Type headers
+ * into 'buf'. The Connection header and the final empty line are not
+ * included. Returns the length of the header.
+ */
+int _net_generate_header(char* buf, size_t size, const char* status, off_t len, const char* mime)
+{
+	int headerLen = snprintf(buf, size, "HTTP/1.1 %s\r\nContent-Length: %lld\r\nContent-Type: %s\r\n",
+			status, (long long) len, mime);
+
+	return ((headerLen < 0) || ((size_t) headerLen >= size)) ? (int) size - 1 : headerLen;
+}
+
+/*
+ * Sets up the io_uring engine. Returns FALSE (after saying so) if the
+ * kernel does not support it, in which case the epoll loop is used.
+ */
+BOOL _net_ring_start_up()
+{
+	if(ior_init(&_net_ring, NET_RING_ENTRIES) != IOR_OK)
+	{
+		fprintf(stderr, "io_uring is not available, falling back to epoll.\n");
+		return FALSE;
+	}
+
+	_net_ring_active = TRUE;
+	return TRUE;
+}
+
+/*
+ * The main loop of the io_uring engine. Each iteration submits all
+ * operations prepared while handling the previous completions and waits
+ * for new ones with a single io_uring_enter().
+ */
+void _net_ring_main_loop()
+{
+	int slot;
+	for(slot = 0; slot < NET_RING_ACCEPTS; ++slot)
+		_net_ring_arm_accept(slot);
+	_net_ring_arm_tick();
+	_net_ring_arm_index();
+
+	while(_net_stop_main_loop == FALSE)
+	{
+		int ret = ior_submit_and_wait(&_net_ring, 1);
+		if((ret < 0) && (ret != -EINTR) && (ret != -EBUSY) && (ret != -EAGAIN))
+		{
+			fprintf(stderr, "Error: Could not wait on io_uring.\n");
+			break;
+		}
+		_net_now = tmr_now();
+
+		struct io_uring_cqe* cqe;
+		while((cqe = ior_peek_cqe(&_net_ring)) != NULL)
+		{
+			uint64_t tag = cqe->user_data;
+			int res = cqe->res;
+			ior_cqe_seen(&_net_ring);
+			_net_ring_complete(tag, res);
+		}
+
+		// Close the connections which have missed their deadline
+		_net_expire_timeouts();
+	}
+
+	// Abort all connections. Their buffers may only be freed once the
+	// operations referring to them have completed.
+	for(slot = 0; slot < cls_get_capacity(); ++slot)
+	{
+		struct cls_connection* conn = cls_get(slot);
+		if(conn != NULL)
+			_net_ring_close(conn);
+	}
+	while(cls_get_length() > 0)
+	{
+		int ret = ior_submit_and_wait(&_net_ring, 1);
+		if((ret < 0) && (ret != -EINTR) && (ret != -EBUSY) && (ret != -EAGAIN))
+			break;
+
+		struct io_uring_cqe* cqe;
+		while((cqe = ior_peek_cqe(&_net_ring)) != NULL)
+		{
+			uint64_t tag = cqe->user_data;
+			int res = cqe->res;
+			ior_cqe_seen(&_net_ring);
+			_net_ring_complete(tag, res);
+		}
+	}
+
+	// Submit the last closes, then tear down the ring
+	ior_submit_and_wait(&_net_ring, 0);
+	ior_exit(&_net_ring);
+	close(_net_listening_socket);
+
+	cls_clean_up();
+}
+
+/*
+ * Handles the completion of an operation of the io_uring engine. 'res' is
+ * the result of the corresponding system call, or a negative errno value.
+ */
+void _net_ring_complete(uint64_t tag, int res)
+{
+	int op = tag & 0xff;
+	int fd = tag >> 8;
+
+	if(op == NET_OP_ACCEPT)
+	{
+		// 'fd' is the slot of the accept here
+		if(res >= 0)
+		{
+			if(_net_stop_main_loop == FALSE)
+				_net_ring_accepted(res, &_net_ring_clients[fd]);
+			else
+				close(res);
+		}
+		else if((res != -EAGAIN) && (res != -EINTR) && (res != -ECONNABORTED))
+		{
+			fprintf(stderr, "Error: Could not accept connection.\n");
+		}
+
+		if(_net_stop_main_loop == FALSE)
+			_net_ring_arm_accept(fd);
+		return;
+	}
+	else if(op == NET_OP_TICK)
+	{
+		// Only wakes up the loop, which checks the deadlines
+		if(_net_stop_main_loop == FALSE)
+			_net_ring_arm_tick();
+		return;
+	}
+	else if(op == NET_OP_INDEX)
+	{
+		// Apply changes to the www tree
+		if(res >= 0)
+			res_update_index();
+		if(_net_stop_main_loop == FALSE)
+			_net_ring_arm_index();
+		return;
+	}
+	else if(op == NET_OP_CLOSE)
+	{
+		return;
+	}
+
+	struct cls_connection* conn = cls_lookup(fd);
+	if(conn == NULL)
+		return;
+	--conn->ringOps;
+
+	if(op == NET_OP_RECV)
+	{
+		conn->ringRecv = FALSE;
+		if(res <= 0)
+		{
+			// The client closed the connection, or reading failed
+			conn->ringClosing = TRUE;
+		}
+		else
+		{
+			conn->inLen += res;
+			conn->lastRead = met_now();
+		}
+	}
+	else if(op == NET_OP_SEND)
+	{
+		conn->ringSend = FALSE;
+		if(res < 0)
+		{
+			conn->ringClosing = TRUE;
+		}
+		else
+		{
+			oq_consume(&conn->out, res);
+			_net_set_timeout(conn, NET_WAIT_SEND);
+			met_count_bytes(res);
+		}
+	}
+	else if(op == NET_OP_SPLICE_IN)
+	{
+		if(res <= 0)
+		{
+			// The file is shorter than announced, or could not be read
+			conn->ringClosing = TRUE;
+		}
+		else
+		{
+			// Those bytes are on their way now
+			conn->pipeBytes += res;
+			oq_consume(&conn->out, res);
+		}
+	}
+	else if(op == NET_OP_SPLICE_OUT)
+	{
+		conn->ringSend = FALSE;
+		if(res > 0)
+		{
+			conn->pipeBytes -= res;
+			_net_set_timeout(conn, NET_WAIT_SEND);
+			met_count_bytes(res);
+		}
+		else if(res != -ECANCELED)
+		{
+			// If the file could not be spliced into the pipe, this one is
+			// cancelled; the rest of the pipe is sent next.
+			conn->ringClosing = TRUE;
+		}
+	}
+
+	_net_ring_continue(conn);
+}
+
+/*
+ * Adds a connection accepted by the io_uring engine and starts receiving.
+ */
+void _net_ring_accepted(int socket, const struct sockaddr_in* client)
+{
+	// Responses are written in whole, so there is nothing to gain from
+	// Nagle's algorithm; it would only delay the last segment.
+	int on = 1;
+	setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+	struct cls_connection* conn = cls_add(socket);
+	if(conn == NULL)
+	{
+		fprintf(stderr, "Error: Out of memory.\n");
+		close(socket);
+		return;
+	}
+	conn->clientAddr = client->sin_addr.s_addr;
+	req_init(&conn->parser);
+	oq_init(&conn->out);
+	conn->pipeFds[0] = -1;
+	conn->pipeFds[1] = -1;
+	met_count_accept();
+
+	_net_ring_continue(conn);
+}
+
+/*
+ * Decides on the next operation of a connection after one has completed:
+ * sends pending output, answers the requests received so far or receives
+ * more. Like the epoll loop, nothing is read while output is pending.
+ */
+void _net_ring_continue(struct cls_connection* conn)
+{
+	if(conn->ringClosing == TRUE)
+	{
+		// Wake up the operations in flight by shutting the socket down;
+		// the connection is removed once they have all completed.
+		tmr_cancel(&_net_timers, &conn->timer);
+		if(conn->ringOps > 0)
+			shutdown(conn->socketFd, SHUT_RDWR);
+		else
+			_net_ring_finish_close(conn);
+		return;
+	}
+
+	if((conn->ringSend == TRUE) || (conn->ringRecv == TRUE))
+	{
+		_net_update_timeout(conn);
+		return;
+	}
+
+	// Answer the requests received so far, unless output is pending
+	oq_consume(&conn->out, 0);
+	if((conn->pipeBytes == 0) && (oq_is_empty(&conn->out) == TRUE))
+	{
+		if(conn->closeAfterFlush == TRUE)
+		{
+			_net_ring_close(conn);
+			return;
+		}
+
+		_net_queue_responses(conn);
+
+		// Wait for the rest of the request. If the buffer is full, the
+		// request is too large.
+		if((oq_is_empty(&conn->out) == TRUE) && (conn->inLen == NET_MAX_REQUEST_SIZE))
+			_net_queue_error_page(conn, &_net_400_page, FALSE, FALSE);
+	}
+
+	BOOL ok;
+	if((conn->pipeBytes > 0) || (oq_is_empty(&conn->out) == FALSE))
+		ok = _net_ring_send(conn);
+	else
+	{
+		// Idle until the next request, see _net_handle_input()
+		oq_clear(&conn->out);
+		ok = _net_ring_recv(conn);
+	}
+
+	if(ok == FALSE)
+		_net_ring_close(conn);
+	else
+		_net_update_timeout(conn);
+}
+
+/*
+ * Submits the next piece of a connection's output: what is left in its
+ * pipe, the file at the head of the queue (spliced into the pipe and from
+ * there to the socket by two linked operations) or the memory segments at
+ * the head of the queue (one sendmsg()). Returns FALSE on failure.
+ */
+BOOL _net_ring_send(struct cls_connection* conn)
+{
+	struct io_uring_sqe* sqe;
+
+	if(conn->pipeBytes > 0)
+	{
+		sqe = _net_ring_sqe(conn, NET_OP_SPLICE_OUT);
+		if(sqe == NULL)
+			return FALSE;
+		ior_prep_splice(sqe, conn->pipeFds[0], -1, conn->socketFd, conn->pipeBytes);
+		conn->ringSend = TRUE;
+		return TRUE;
+	}
+
+	int fd;
+	off_t offset;
+	off_t len;
+	if(oq_head_file(&conn->out, &fd, &offset, &len) == TRUE)
+	{
+		if((conn->pipeFds[0] < 0) && (pipe2(conn->pipeFds, O_CLOEXEC) != 0))
+		{
+			conn->pipeFds[0] = -1;
+			conn->pipeFds[1] = -1;
+			return FALSE;
+		}
+
+		// Both halves are linked, so they have to be submitted together
+		if(ior_reserve(&_net_ring, 2) == FALSE)
+			return FALSE;
+
+		unsigned chunk = (len < NET_RING_SPLICE_CHUNK) ? len : NET_RING_SPLICE_CHUNK;
+		sqe = _net_ring_sqe(conn, NET_OP_SPLICE_IN);
+		ior_prep_splice(sqe, fd, offset, conn->pipeFds[1], chunk);
+		sqe->flags |= IOSQE_IO_LINK;
+
+		sqe = _net_ring_sqe(conn, NET_OP_SPLICE_OUT);
+		ior_prep_splice(sqe, conn->pipeFds[0], -1, conn->socketFd, chunk);
+		conn->ringSend = TRUE;
+		return TRUE;
+	}
+
+	if(conn->sendIov == NULL)
+	{
+		conn->sendIov = mp_get(NET_RING_MAX_IOV * sizeof(struct iovec));
+		if(conn->sendIov == NULL)
+		{
+			fprintf(stderr, "Error: Out of memory.\n");
+			return FALSE;
+		}
+	}
+
+	// Tell the kernel to hold back a partial segment if more data follows
+	BOOL more;
+	memset(&conn->sendMsg, 0, sizeof(struct msghdr));
+	conn->sendMsg.msg_iov = conn->sendIov;
+	conn->sendMsg.msg_iovlen = oq_gather(&conn->out, conn->sendIov, NET_RING_MAX_IOV, &more);
+	int flags = MSG_NOSIGNAL;
+	if(more == TRUE)
+		flags |= MSG_MORE;
+
+	sqe = _net_ring_sqe(conn, NET_OP_SEND);
+	if(sqe == NULL)
+		return FALSE;
+	ior_prep_sendmsg(sqe, conn->socketFd, &conn->sendMsg, flags);
+	conn->ringSend = TRUE;
+	return TRUE;
+}
+
+/*
+ * Submits a receive into the free part of a connection's receive buffer,
+ * growing it first if necessary. Returns FALSE on failure.
+ */
+BOOL _net_ring_recv(struct cls_connection* conn)
+{
+	if((conn->inLen == conn->inCap) && (_net_grow_input_buffer(conn) == FALSE))
+		return FALSE;
+
+	struct io_uring_sqe* sqe = _net_ring_sqe(conn, NET_OP_RECV);
+	if(sqe == NULL)
+		return FALSE;
+	ior_prep_recv(sqe, conn->socketFd, &conn->inBuf[conn->inLen], conn->inCap - conn->inLen);
+	conn->ringRecv = TRUE;
+	return TRUE;
+}
+
+/*
+ * Starts closing a connection of the io_uring engine (see
+ * _net_ring_continue()). The connection must not be used afterwards.
+ */
+void _net_ring_close(struct cls_connection* conn)
+{
+	conn->ringClosing = TRUE;
+	_net_ring_continue(conn);
+}
+
+/*
+ * Removes a connection without operations in flight from the connection
+ * table. Its socket is closed with the next submission.
+ */
+void _net_ring_finish_close(struct cls_connection* conn)
+{
+	int socket = conn->socketFd;
+
+	oq_clear(&conn->out);
+	mp_put(conn->inBuf, conn->inCap);
+	mp_put(conn->sendIov, NET_RING_MAX_IOV * sizeof(struct iovec));
+	if(conn->pipeFds[0] >= 0)
+	{
+		_net_ring_close_fd(conn->pipeFds[0]);
+		_net_ring_close_fd(conn->pipeFds[1]);
+	}
+
+	cls_remove(socket);
+	_net_ring_close_fd(socket);
+	met_count_close();
+}
+
+/*
+ * Closes a file descriptor with the next submission.
+ */
+void _net_ring_close_fd(int fd)
+{
+	struct io_uring_sqe* sqe = ior_get_sqe(&_net_ring, ((uint64_t) fd << 8) | NET_OP_CLOSE);
+	if(sqe != NULL)
+		ior_prep_close(sqe, fd);
+	else
+		close(fd);
+}
+
+/*
+ * Submits an accept on the listening socket, receiving the client's address
+ * in 'slot' (0..NET_RING_ACCEPTS-1). NET_RING_ACCEPTS accepts are in flight
+ * at any time, so a burst of connections is taken in few iterations; each
+ * is renewed whenever it completes.
+ */
+void _net_ring_arm_accept(int slot)
+{
+	struct io_uring_sqe* sqe = ior_get_sqe(&_net_ring, ((uint64_t) slot << 8) | NET_OP_ACCEPT);
+	if(sqe != NULL)
+	{
+		_net_ring_client_lens[slot] = sizeof(_net_ring_clients[slot]);
+		ior_prep_accept(sqe, _net_listening_socket, (struct sockaddr*) &_net_ring_clients[slot],
+				&_net_ring_client_lens[slot], SOCK_CLOEXEC);
+	}
+}
+
+/*
+ * Submits the timeout waking the loop up for the next deadline, or after
+ * NET_RING_MAX_TICK. Deadlines set meanwhile are no earlier than that.
+ */
+void _net_ring_arm_tick()
+{
+	int timeout = tmr_next_timeout(&_net_timers, tmr_now());
+	if((timeout < 0) || (timeout > NET_RING_MAX_TICK))
+		timeout = NET_RING_MAX_TICK;
+	_net_ring_tick.tv_sec = timeout / 1000;
+	_net_ring_tick.tv_nsec = (timeout % 1000) * 1000000L;
+
+	struct io_uring_sqe* sqe = ior_get_sqe(&_net_ring, NET_OP_TICK);
+	if(sqe != NULL)
+		ior_prep_timeout(sqe, &_net_ring_tick);
+}
+
+/*
+ * Submits a poll for changes to the file index, if there is one. It is
+ * renewed whenever it completes.
+ */
+void _net_ring_arm_index()
+{
+	if(_net_index_fd < 0)
+		return;
+
+	struct io_uring_sqe* sqe = ior_get_sqe(&_net_ring, NET_OP_INDEX);
+	if(sqe != NULL)
+		ior_prep_poll_add(sqe, _net_index_fd, POLLIN);
+}
+
+/*
+ * Returns a submission queue entry for an operation on a connection's
+ * socket, counting it as in flight. Returns NULL if the ring is broken.
+ */
+struct io_uring_sqe* _net_ring_sqe(struct cls_connection* conn, int op)
+{
+	struct io_uring_sqe* sqe = ior_get_sqe(&_net_ring, ((uint64_t) conn->socketFd << 8) | op);
+	if(sqe != NULL)
+		++conn->ringOps;
+	return sqe;
 }
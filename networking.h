@@ -9,23 +9,53 @@
 #ifndef NETWORKING_H_
 #define NETWORKING_H_
 
+#include "base.h"
+
 /**************************** Module types & constants ***********************/
 
 extern const int NET_OK;
 extern const int NET_SOCKET_ERROR;
 extern const int NET_BIND_ERROR;
 extern const int NET_LISTEN_ERROR;
+extern const int NET_EPOLL_ERROR;
 
 /**************************** Module interface *******************************/
 
 /*
- * This should be called to start the network.
+ * Selects the io_uring engine instead of the epoll readiness loop: accept,
+ * receive, send (files are spliced through a pipe) and close are submitted
+ * to an io_uring and completed asynchronously, so a single system call per
+ * loop iteration submits all new operations and collects their results.
+ * If the kernel does not support io_uring (or an operation used), the epoll
+ * loop is used. Has to be called before net_start_up().
+ */
+void net_use_io_uring(BOOL enabled);
+
+/*
+ * Serves the metrics of all workers (see met_report()) as plain text at
+ * 'path' (eg. '/__stats'), which hides a file of that name. Off unless set.
+ * 'path' must stay valid. Has to be called before net_start_up().
+ */
+void net_set_stats_path(const char* path);
+
+/*
+ * Sets the length of the queue of connections waiting to be accepted
+ * (default 4096, the kernel cuts it down to net.core.somaxconn). Bursts of
+ * new connections beyond it are dropped and retried by the clients after a
+ * second. Has to be called before net_start_up().
+ */
+void net_set_backlog(int backlog);
+
+/*
+ * This should be called to start the network. The listening socket is
+ * opened with SO_REUSEPORT, so every worker process calls this on its own.
  */
 int net_start_up(int port);
 
 /*
  * This is a main loop which does the following:
- * - Select on the sockets
+ * - Wait for events on the sockets (epoll, edge-triggered) or for
+ *   completions (io_uring)
  * - Accept incoming connections OR
  * - Read data from the connected clients
  */
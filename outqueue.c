@@ -0,0 +1,345 @@
+/*
+ * outqueue.c
+ *
+ * This file contains the module 'outqueue'. Responses are queued per
+ * connection and written whenever the socket can take more data, so a
+ * short write is a normal event instead of an error. Adjacent memory
+ * segments are gathered into a single sendmsg(), file ranges are sent with
+ * sendfile(). Memory followed by more data is sent with MSG_MORE, so a
+ * header and the file behind it leave in the same TCP segment.
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#include "outqueue.h"
+#include "mempool.h"
+
+#include <string.h>
+
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**************************** Local types ************************************/
+
+struct _oq_segment
+{
+	BOOL isFile;
+	const char* data; /* memory segment */
+	int fd; /* file segment */
+
+	oq_release_fn release;
+	void* ctx;
+
+	off_t offset; /* offset of the next byte to send */
+	off_t remaining; /* bytes left to send */
+
+	struct _oq_segment* next;
+};
+
+/**************************** Prototypes *************************************/
+
+struct _oq_segment* _oq_new_segment(struct oq_queue* queue, off_t len);
+void _oq_pop_segment(struct oq_queue* queue);
+int _oq_flush_mem(struct oq_queue* queue, int socket);
+int _oq_flush_file(struct oq_queue* queue, int socket);
+
+/**************************** Global constants *******************************/
+
+const int OQ_OK = 0;
+const int OQ_DONE = 1;
+const int OQ_AGAIN = 2;
+const int OQ_ERROR = 3;
+const int OQ_OUT_OF_MEMORY = 4;
+
+/**************************** Local constants ********************************/
+
+/* maximum number of memory segments gathered into one sendmsg() */
+#define OQ_MAX_IOV 64
+
+/**************************** Module interface *******************************/
+
+void oq_init(struct oq_queue* queue)
+{
+	queue->head = NULL;
+	queue->tail = NULL;
+	queue->length = 0;
+	mp_arena_init(&queue->arena);
+}
+
+int oq_push_mem(struct oq_queue* queue, const void* data, size_t len,
+		oq_release_fn release, void* ctx)
+{
+	struct _oq_segment* seg = _oq_new_segment(queue, len);
+	if(seg == NULL)
+	{
+		if(release != NULL)
+			release(ctx);
+		return OQ_OUT_OF_MEMORY;
+	}
+
+	seg->isFile = FALSE;
+	seg->data = data;
+	seg->release = release;
+	seg->ctx = ctx;
+
+	return OQ_OK;
+}
+
+int oq_push_copy(struct oq_queue* queue, const void* data, size_t len)
+{
+	char* copy = mp_alloc(&queue->arena, len);
+	if(copy == NULL)
+		return OQ_OUT_OF_MEMORY;
+	memcpy(copy, data, len);
+
+	return oq_push_mem(queue, copy, len, NULL, NULL);
+}
+
+int oq_push_file(struct oq_queue* queue, int fd, off_t offset, off_t len,
+		oq_release_fn release, void* ctx)
+{
+	struct _oq_segment* seg = _oq_new_segment(queue, len);
+	if(seg == NULL)
+	{
+		if(release != NULL)
+			release(ctx);
+		return OQ_OUT_OF_MEMORY;
+	}
+
+	seg->isFile = TRUE;
+	seg->fd = fd;
+	seg->offset = offset;
+	seg->release = release;
+	seg->ctx = ctx;
+
+	return OQ_OK;
+}
+
+int oq_flush(struct oq_queue* queue, int socket)
+{
+	while(queue->head != NULL)
+	{
+		int ret = (queue->head->isFile == TRUE) ?
+				_oq_flush_file(queue, socket) : _oq_flush_mem(queue, socket);
+		if(ret != OQ_OK)
+			return ret;
+	}
+
+	return OQ_DONE;
+}
+
+BOOL oq_is_empty(const struct oq_queue* queue)
+{
+	return (queue->head == NULL) ? TRUE : FALSE;
+}
+
+void oq_clear(struct oq_queue* queue)
+{
+	while(queue->head != NULL)
+		_oq_pop_segment(queue);
+	mp_release(&queue->arena);
+}
+
+void oq_truncate(struct oq_queue* queue, struct _oq_segment* mark)
+{
+	if(mark == NULL)
+	{
+		oq_clear(queue);
+		return;
+	}
+
+	// The dropped segments' memory stays in the arena until the queue runs
+	// empty
+	struct _oq_segment* seg = mark->next;
+	while(seg != NULL)
+	{
+		queue->length -= seg->remaining;
+		if(seg->release != NULL)
+			seg->release(seg->ctx);
+		seg = seg->next;
+	}
+	mark->next = NULL;
+	queue->tail = mark;
+}
+
+int oq_gather(const struct oq_queue* queue, struct iovec* iov, int maxIov, BOOL* more)
+{
+	int iovCnt = 0;
+	struct _oq_segment* seg = queue->head;
+	while((seg != NULL) && (seg->isFile == FALSE) && (iovCnt < maxIov))
+	{
+		iov[iovCnt].iov_base = (void*) (seg->data + seg->offset);
+		iov[iovCnt].iov_len = seg->remaining;
+		++iovCnt;
+		seg = seg->next;
+	}
+
+	*more = (seg != NULL) ? TRUE : FALSE;
+	return iovCnt;
+}
+
+BOOL oq_head_file(const struct oq_queue* queue, int* fd, off_t* offset, off_t* len)
+{
+	struct _oq_segment* seg = queue->head;
+	if((seg == NULL) || (seg->isFile == FALSE))
+		return FALSE;
+
+	*fd = seg->fd;
+	*offset = seg->offset;
+	*len = seg->remaining;
+	return TRUE;
+}
+
+void oq_consume(struct oq_queue* queue, off_t len)
+{
+	while(len > 0)
+	{
+		struct _oq_segment* seg = queue->head;
+		if(len >= seg->remaining)
+		{
+			len -= seg->remaining;
+			_oq_pop_segment(queue);
+		}
+		else
+		{
+			seg->offset += len;
+			seg->remaining -= len;
+			queue->length -= len;
+			len = 0;
+		}
+	}
+
+	// Empty segments at the head are done, too
+	while((queue->head != NULL) && (queue->head->remaining == 0))
+		_oq_pop_segment(queue);
+}
+
+/**************************** Local methods **********************************/
+
+/*
+ * Allocates a segment of 'len' bytes and appends it to the queue.
+ * Returns NULL if out of memory.
+ */
+struct _oq_segment* _oq_new_segment(struct oq_queue* queue, off_t len)
+{
+	struct _oq_segment* seg = mp_alloc(&queue->arena, sizeof(struct _oq_segment));
+	if(seg == NULL)
+		return NULL;
+
+	memset(seg, 0, sizeof(struct _oq_segment));
+	seg->offset = 0;
+	seg->remaining = len;
+	seg->next = NULL;
+
+	if(queue->tail == NULL)
+		queue->head = seg;
+	else
+		queue->tail->next = seg;
+	queue->tail = seg;
+	queue->length += len;
+
+	return seg;
+}
+
+/*
+ * Removes the first segment from the queue and releases its resources.
+ * Once the queue is empty, its arena is reset.
+ */
+void _oq_pop_segment(struct oq_queue* queue)
+{
+	struct _oq_segment* seg = queue->head;
+
+	queue->head = seg->next;
+	queue->length -= seg->remaining;
+
+	if(seg->release != NULL)
+		seg->release(seg->ctx);
+
+	if(queue->head == NULL)
+	{
+		queue->tail = NULL;
+		mp_reset(&queue->arena);
+	}
+}
+
+/*
+ * Sends the memory segments at the head of the queue with one sendmsg().
+ * Returns OQ_OK if progress was made, OQ_AGAIN or OQ_ERROR.
+ */
+int _oq_flush_mem(struct oq_queue* queue, int socket)
+{
+	struct iovec iov[OQ_MAX_IOV];
+	BOOL more;
+	int iovCnt = oq_gather(queue, iov, OQ_MAX_IOV, &more);
+
+	size_t total = 0;
+	int i;
+	for(i = 0; i < iovCnt; ++i)
+		total += iov[i].iov_len;
+
+	// Tell the kernel to hold back a partial segment if more data follows
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovCnt;
+	int flags = MSG_NOSIGNAL;
+	if(more == TRUE)
+		flags |= MSG_MORE;
+
+	ssize_t bytesSent = sendmsg(socket, &msg, flags);
+	if(bytesSent < 0)
+	{
+		if(errno == EINTR)
+			return OQ_OK;
+		if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			return OQ_AGAIN;
+		return OQ_ERROR;
+	}
+
+	// A short write means the socket buffer is full
+	BOOL full = ((size_t) bytesSent < total) ? TRUE : FALSE;
+
+	oq_consume(queue, bytesSent);
+
+	return (full == TRUE) ? OQ_AGAIN : OQ_OK;
+}
+
+/*
+ * Sends the file segment at the head of the queue with sendfile().
+ * Returns OQ_OK if progress was made, OQ_AGAIN or OQ_ERROR.
+ */
+int _oq_flush_file(struct oq_queue* queue, int socket)
+{
+	struct _oq_segment* seg = queue->head;
+
+	while(seg->remaining > 0)
+	{
+		off_t before = seg->offset;
+		ssize_t bytesSent = sendfile(socket, seg->fd, &seg->offset, seg->remaining);
+		if(bytesSent < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return OQ_AGAIN;
+			return OQ_ERROR;
+		}
+		else if(bytesSent == 0)
+		{
+			// The file is shorter than announced
+			return OQ_ERROR;
+		}
+
+		bytesSent = seg->offset - before;
+		seg->remaining -= bytesSent;
+		queue->length -= bytesSent;
+	}
+
+	_oq_pop_segment(queue);
+	return OQ_OK;
+}
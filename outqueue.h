@@ -0,0 +1,138 @@
+/*
+ * outqueue.h
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#ifndef OUTQUEUE_H_
+#define OUTQUEUE_H_
+
+#include "base.h"
+#include "mempool.h"
+
+#include <stddef.h> // for size_t
+#include <sys/types.h> // for off_t
+#include <sys/uio.h> // for struct iovec
+
+/**************************** Module types & constants ***********************/
+
+/*
+ * called when a segment has been sent or the queue is cleared
+ */
+typedef void (*oq_release_fn)(void* ctx);
+
+struct _oq_segment;
+
+/*
+ * a queue of data waiting to be written to a socket. Segments are either
+ * memory blocks or ranges of a file, and are sent in order. The segments
+ * (and copied data) are allocated from the queue's arena, which is reset
+ * whenever the queue runs empty.
+ */
+struct oq_queue
+{
+	struct _oq_segment* head;
+	struct _oq_segment* tail;
+	off_t length; /* number of bytes still to be sent */
+	struct mp_arena arena;
+};
+
+/*
+ * these constants are returned by the functions below.
+ */
+extern const int OQ_OK;
+extern const int OQ_DONE;
+extern const int OQ_AGAIN;
+extern const int OQ_ERROR;
+extern const int OQ_OUT_OF_MEMORY;
+
+/**************************** Module interface *******************************/
+
+/*
+ * Initializes an empty queue.
+ */
+void oq_init(struct oq_queue* queue);
+
+/*
+ * Appends 'len' bytes at 'data' without copying them. 'release' is called
+ * with 'ctx' once the bytes are no longer needed; it may be NULL for static
+ * data. On failure, 'release' is called right away.
+ * Returns OQ_OK or OQ_OUT_OF_MEMORY.
+ */
+int oq_push_mem(struct oq_queue* queue, const void* data, size_t len,
+		oq_release_fn release, void* ctx);
+
+/*
+ * Appends a copy of 'len' bytes at 'data'. The copy is kept in the queue's
+ * arena.
+ * Returns OQ_OK or OQ_OUT_OF_MEMORY.
+ */
+int oq_push_copy(struct oq_queue* queue, const void* data, size_t len);
+
+/*
+ * Appends 'len' bytes of the file 'fd' starting at 'offset'. The file is
+ * sent with sendfile(), the file position of 'fd' is not changed. 'release'
+ * is called with 'ctx' once the fd is no longer needed; it may be NULL. On
+ * failure, 'release' is called right away.
+ * Returns OQ_OK or OQ_OUT_OF_MEMORY.
+ */
+int oq_push_file(struct oq_queue* queue, int fd, off_t offset, off_t len,
+		oq_release_fn release, void* ctx);
+
+/*
+ * Writes as much of the queue to the (non-blocking) socket as possible.
+ * Return values:
+ * - OQ_DONE : the queue is empty
+ * - OQ_AGAIN : the socket buffer is full; retry when it becomes writable
+ * - OQ_ERROR : the socket failed or a file could not be read
+ */
+int oq_flush(struct oq_queue* queue, int socket);
+
+/*
+ * The following functions allow sending the queue by other means than
+ * oq_flush() (e.g. asynchronously): look at its head, send, then consume
+ * what has been sent.
+ */
+
+/*
+ * Describes the memory segments at the head of the queue (up to 'maxIov')
+ * in 'iov'. 'more' is set to TRUE if other segments follow them.
+ * Returns the number of entries used, 0 if the head is a file segment or
+ * the queue is empty.
+ */
+int oq_gather(const struct oq_queue* queue, struct iovec* iov, int maxIov, BOOL* more);
+
+/*
+ * If the head of the queue is a file segment, sets 'fd', 'offset' and 'len'
+ * to the range still to be sent and returns TRUE.
+ */
+BOOL oq_head_file(const struct oq_queue* queue, int* fd, off_t* offset, off_t* len);
+
+/*
+ * Removes 'len' sent bytes from the head of the queue, releasing the
+ * segments which are done, including empty segments at the head.
+ */
+void oq_consume(struct oq_queue* queue, off_t len);
+
+/*
+ * Returns TRUE if the queue has nothing left to send.
+ */
+BOOL oq_is_empty(const struct oq_queue* queue);
+
+/*
+ * Drops all queued segments, releasing their resources, and gives the
+ * queue's memory back to the pool.
+ */
+void oq_clear(struct oq_queue* queue);
+
+/*
+ * Drops the segments appended behind 'mark', the queue's tail as it was
+ * before (NULL if the queue was empty), and releases their resources. This
+ * takes back a response which could only be queued in part. Nothing may
+ * have been sent since 'mark' was taken.
+ */
+void oq_truncate(struct oq_queue* queue, struct _oq_segment* mark);
+
+#endif /* OUTQUEUE_H_ */
@@ -0,0 +1,665 @@
+/*
+ * request.c
+ *
+ * This file contains the module 'request', an incremental HTTP request
+ * parser. It is fed the bytes of a connection's receive buffer as they
+ * arrive and remembers how far it got, so a request split over many reads
+ * is scanned exactly once. Line ends and forbidden control characters are
+ * found in one pass, 16 or 32 bytes at a time with SSE4.2 or AVX2 if the
+ * CPU has them. The headers are recorded in a table of offsets into the
+ * request, so they can be looked at later without copying them or scanning
+ * the request again.
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#include "request.h"
+
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define REQ_X86
+#endif
+
+/**************************** Local types ************************************/
+
+/*
+ * a scanner, see _req_scan_scalar()
+ */
+typedef size_t (*_req_scan_fn)(const char* buf, size_t len);
+
+/**************************** Prototypes *************************************/
+
+size_t _req_scan_select(const char* buf, size_t len);
+size_t _req_scan_scalar(const char* buf, size_t len);
+#ifdef REQ_X86
+size_t _req_scan_sse42(const char* buf, size_t len);
+size_t _req_scan_avx2(const char* buf, size_t len);
+#endif
+
+BOOL _req_parse_request_line(struct req_parser* parser, const char* line, size_t len);
+BOOL _req_parse_version(struct req_parser* parser, const char* version, size_t len);
+BOOL _req_parse_header(struct req_parser* parser, const char* line, size_t len);
+int _req_known_header(const char* name, size_t len);
+BOOL _req_has_token(const char* value, size_t len, const char* token);
+BOOL _req_accepts_coding(const char* value, size_t len, const char* coding);
+BOOL _req_zero_quality(const char* params, size_t len);
+time_t _req_parse_http_date(const char* value, size_t len);
+BOOL _req_parse_number(const char* digits, size_t len, int* number);
+
+/**************************** Global constants *******************************/
+
+const int REQ_COMPLETE = 0;
+const int REQ_INCOMPLETE = 1;
+const int REQ_BAD_REQUEST = 2;
+
+const int REQ_METHOD_GET = 0;
+const int REQ_METHOD_HEAD = 1;
+const int REQ_METHOD_OTHER = 2;
+
+/**************************** Local constants ********************************/
+
+/* parser states */
+#define REQ_STATE_REQUEST_LINE 0
+#define REQ_STATE_HEADERS 1
+#define REQ_STATE_DONE 2
+
+/* length of an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT") */
+#define REQ_HTTP_DATE_LENGTH 29
+
+/* whether a scanner stops at a byte: at control characters except tab and
+ * carriage return (so at line feeds), and at DEL */
+#define REQ_IS_STOP(c) ((((c) < 0x20) && ((c) != '\t') && ((c) != '\r')) || ((c) == 0x7f))
+
+/**************************** Local variables ********************************/
+
+/* the scanner for this CPU, chosen on first use */
+_req_scan_fn _req_scan = _req_scan_select;
+
+/* the names of the well-known headers, by REQ_HEADER_xxx */
+const char* const _req_known_names[REQ_KNOWN_HEADERS] =
+{
+	[REQ_HEADER_HOST] = "Host",
+	[REQ_HEADER_CONNECTION] = "Connection",
+	[REQ_HEADER_ACCEPT_ENCODING] = "Accept-Encoding",
+	[REQ_HEADER_IF_NONE_MATCH] = "If-None-Match",
+	[REQ_HEADER_IF_MODIFIED_SINCE] = "If-Modified-Since",
+	[REQ_HEADER_RANGE] = "Range",
+	[REQ_HEADER_IF_RANGE] = "If-Range",
+	[REQ_HEADER_USER_AGENT] = "User-Agent",
+	[REQ_HEADER_REFERER] = "Referer",
+	[REQ_HEADER_CONTENT_LENGTH] = "Content-Length",
+	[REQ_HEADER_TRANSFER_ENCODING] = "Transfer-Encoding"
+};
+
+/**************************** Module interface *******************************/
+
+void req_init(struct req_parser* parser)
+{
+	// The header table is only valid up to headerCount, so it need not be
+	// cleared
+	memset(parser, 0, offsetof(struct req_parser, headers));
+	parser->state = REQ_STATE_REQUEST_LINE;
+	parser->versionMajor = 1;
+	parser->versionMinor = 0;
+	parser->connectionClose = FALSE;
+	parser->connectionKeepAlive = FALSE;
+	parser->acceptGzip = FALSE;
+	parser->method = REQ_METHOD_OTHER;
+	parser->ifModifiedSince = -1;
+	parser->ifRangeDate = -1;
+}
+
+int req_parse(struct req_parser* parser, const char* buf, size_t len)
+{
+	while(parser->state != REQ_STATE_DONE)
+	{
+		// Find the end of the current line
+		size_t lineEnd = len;
+		if(parser->scanPos < len)
+			lineEnd = parser->scanPos + _req_scan(&buf[parser->scanPos], len - parser->scanPos);
+		if(lineEnd == len)
+		{
+			// Resume behind the bytes scanned so far next time
+			parser->scanPos = len;
+			return REQ_INCOMPLETE;
+		}
+
+		// Control characters other than tab and carriage return are not
+		// allowed anywhere
+		if(buf[lineEnd] != '\n')
+			return REQ_BAD_REQUEST;
+		parser->scanPos = lineEnd + 1;
+
+		// Strip the line terminator
+		const char* line = &buf[parser->lineStart];
+		size_t lineLen = lineEnd - parser->lineStart;
+		if((lineLen > 0) && (line[lineLen - 1] == '\r'))
+			--lineLen;
+
+		if(parser->state == REQ_STATE_REQUEST_LINE)
+		{
+			// Empty lines before the request line are ignored (RFC 2616, 4.1)
+			if(lineLen > 0)
+			{
+				if(_req_parse_request_line(parser, line, lineLen) == FALSE)
+					return REQ_BAD_REQUEST;
+				parser->state = REQ_STATE_HEADERS;
+			}
+		}
+		else
+		{
+			if(lineLen == 0)
+			{
+				// End of headers
+				parser->state = REQ_STATE_DONE;
+				parser->length = parser->scanPos;
+			}
+			else if(_req_parse_header(parser, line, lineLen) == FALSE)
+			{
+				return REQ_BAD_REQUEST;
+			}
+		}
+
+		parser->lineStart = parser->scanPos;
+	}
+
+	return REQ_COMPLETE;
+}
+
+BOOL req_keep_alive(const struct req_parser* parser)
+{
+	if(parser->connectionClose == TRUE)
+		return FALSE;
+	if(parser->connectionKeepAlive == TRUE)
+		return TRUE;
+
+	// HTTP/1.1 connections are persistent by default
+	if((parser->versionMajor > 1) || ((parser->versionMajor == 1) && (parser->versionMinor >= 1)))
+		return TRUE;
+	return FALSE;
+}
+
+const char* req_get_header(const struct req_parser* parser, const char* buf, int id, size_t* len)
+{
+	if((id < 0) || (id >= REQ_KNOWN_HEADERS) || (parser->known[id] == 0))
+		return NULL;
+
+	const struct req_header* header = &parser->headers[parser->known[id] - 1];
+	*len = header->valueLen;
+	return &buf[header->valueOff];
+}
+
+const char* req_find_header(const struct req_parser* parser, const char* buf, const char* name, size_t* len)
+{
+	size_t nameLen = strlen(name);
+	int i;
+	for(i = 0; i < parser->headerCount; ++i)
+	{
+		const struct req_header* header = &parser->headers[i];
+		if((header->nameLen == nameLen) && (strncasecmp(&buf[header->nameOff], name, nameLen) == 0))
+		{
+			*len = header->valueLen;
+			return &buf[header->valueOff];
+		}
+	}
+	return NULL;
+}
+
+/**************************** Local methods **********************************/
+
+/*
+ * Chooses the fastest scanner the CPU supports, and scans with it.
+ */
+size_t _req_scan_select(const char* buf, size_t len)
+{
+	_req_scan = _req_scan_scalar;
+#ifdef REQ_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		_req_scan = _req_scan_avx2;
+	else if(__builtin_cpu_supports("sse4.2"))
+		_req_scan = _req_scan_sse42;
+#endif
+	return _req_scan(buf, len);
+}
+
+/*
+ * Returns the offset of the first byte in 'buf' at which parsing has to
+ * stop, a line feed or a forbidden control character (see REQ_IS_STOP),
+ * or 'len' if there is none. The scanners below do the same, only faster.
+ */
+size_t _req_scan_scalar(const char* buf, size_t len)
+{
+	size_t pos;
+	for(pos = 0; pos < len; ++pos)
+	{
+		unsigned char c = buf[pos];
+		if(REQ_IS_STOP(c))
+			break;
+	}
+	return pos;
+}
+
+#ifdef REQ_X86
+
+/*
+ * The scanner for CPUs with SSE4.2, comparing 16 bytes at a time against
+ * the ranges of stop bytes.
+ */
+__attribute__((target("sse4.2")))
+size_t _req_scan_sse42(const char* buf, size_t len)
+{
+	static const char ranges[16] = "\x00\x08\x0a\x0c\x0e\x1f\x7f\x7f";
+
+	if(len < 16)
+		return _req_scan_scalar(buf, len);
+
+	const __m128i stop = _mm_loadu_si128((const __m128i*) ranges);
+	size_t pos = 0;
+	for(;;)
+	{
+		// The last block overlaps the one before, whose bytes are known
+		// not to stop the scan
+		if(pos + 16 > len)
+			pos = len - 16;
+
+		__m128i block = _mm_loadu_si128((const __m128i*) &buf[pos]);
+		int index = _mm_cmpestri(stop, 8, block, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES);
+		if(index < 16)
+			return pos + index;
+		if(pos + 16 == len)
+			return len;
+		pos += 16;
+	}
+}
+
+/*
+ * The scanner for CPUs with AVX2, looking at 32 bytes at a time: bytes up
+ * to 0x1f except tab and carriage return, and DEL.
+ */
+__attribute__((target("avx2")))
+size_t _req_scan_avx2(const char* buf, size_t len)
+{
+	// Leave short ones to the narrower scanner. It must not run after
+	// 256 bit registers have been used: mixing them with SSE code is slow.
+	if(len < 32)
+		return _req_scan_sse42(buf, len);
+
+	const __m256i ctlMax = _mm256_set1_epi8(0x1f);
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i del = _mm256_set1_epi8(0x7f);
+
+	size_t pos = 0;
+	for(;;)
+	{
+		// The last block overlaps the one before, as above
+		if(pos + 32 > len)
+			pos = len - 32;
+
+		// Tabs and carriage returns are only sorted out in blocks which
+		// contain control characters
+		__m256i block = _mm256_loadu_si256((const __m256i*) &buf[pos]);
+		__m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(block, ctlMax), block);
+		__m256i hit = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(block, del));
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8(hit);
+		if(mask != 0)
+		{
+			__m256i allowed = _mm256_or_si256(_mm256_cmpeq_epi8(block, tab), _mm256_cmpeq_epi8(block, cr));
+			mask &= ~(unsigned int) _mm256_movemask_epi8(allowed);
+			if(mask != 0)
+				return pos + __builtin_ctz(mask);
+		}
+		if(pos + 32 == len)
+			return len;
+		pos += 32;
+	}
+}
+
+#endif /* REQ_X86 */
+
+/*
+ * Splits the request line into method, path and version.
+ * Returns FALSE if it is malformed.
+ */
+BOOL _req_parse_request_line(struct req_parser* parser, const char* line, size_t len)
+{
+	// The method is the first word
+	const char* space = memchr(line, ' ', len);
+	if((space == NULL) || (space == line))
+		return FALSE;
+	size_t pos = space - line;
+	parser->methodOff = parser->lineStart;
+	parser->methodLen = pos;
+	if((pos == 3) && (strncmp(line, "GET", 3) == 0))
+		parser->method = REQ_METHOD_GET;
+	else if((pos == 4) && (strncmp(line, "HEAD", 4) == 0))
+		parser->method = REQ_METHOD_HEAD;
+	else
+		parser->method = REQ_METHOD_OTHER;
+
+	// Skip any following white space just in case...
+	while((pos < len) && (line[pos] == ' '))
+		++pos;
+	if(pos == len)
+		return FALSE;
+
+	// The target reaches up to the next white space or the line end
+	size_t pathStart = pos;
+	space = memchr(&line[pos], ' ', len - pos);
+	pos = (space != NULL) ? (size_t) (space - line) : len;
+	parser->pathOff = parser->lineStart + pathStart;
+	parser->pathLen = pos - pathStart;
+
+	// Split off the query
+	const char* query = memchr(&line[pathStart], '?', pos - pathStart);
+	if(query != NULL)
+	{
+		size_t queryStart = query - line + 1;
+		parser->pathLen = queryStart - 1 - pathStart;
+		parser->queryOff = parser->lineStart + queryStart;
+		parser->queryLen = pos - queryStart;
+	}
+
+	// Skip white space before the version
+	while((pos < len) && (line[pos] == ' '))
+		++pos;
+
+	// A missing version is treated as HTTP/1.0
+	if(pos == len)
+		return TRUE;
+
+	return _req_parse_version(parser, &line[pos], len - pos);
+}
+
+/*
+ * Parses a "HTTP/x.y" version string. Returns FALSE if it is malformed.
+ */
+BOOL _req_parse_version(struct req_parser* parser, const char* version, size_t len)
+{
+	// Trailing white space is tolerated
+	while((len > 0) && (version[len - 1] == ' '))
+		--len;
+
+	if((len != 8) || (strncmp(version, "HTTP/", 5) != 0) || (version[6] != '.'))
+		return FALSE;
+	if((version[5] < '0') || (version[5] > '9') || (version[7] < '0') || (version[7] > '9'))
+		return FALSE;
+
+	parser->versionMajor = version[5] - '0';
+	parser->versionMinor = version[7] - '0';
+	return TRUE;
+}
+
+/*
+ * Records a single header line in the header table and looks at the
+ * values we are interested in. Lines without a colon are ignored.
+ * Returns FALSE if the line ends beyond REQ_MAX_HEADER_END, or if the
+ * header is a Content-Length which contradicts an earlier one (the body
+ * would be ambiguous).
+ */
+BOOL _req_parse_header(struct req_parser* parser, const char* line, size_t len)
+{
+	const char* colon = memchr(line, ':', len);
+	if(colon == NULL)
+		return TRUE;
+	if(parser->lineStart + len > REQ_MAX_HEADER_END)
+		return FALSE;
+
+	size_t nameLen = colon - line;
+	const char* value = colon + 1;
+	size_t valueLen = len - nameLen - 1;
+
+	// Strip white space around the value
+	while((valueLen > 0) && ((*value == ' ') || (*value == '\t')))
+	{
+		++value;
+		--valueLen;
+	}
+	while((valueLen > 0) && ((value[valueLen - 1] == ' ') || (value[valueLen - 1] == '\t')))
+		--valueLen;
+
+	// Lists may be split over several headers; of the others, the first
+	// one counts
+	int id = _req_known_header(line, nameLen);
+	BOOL first = (id >= 0) && (parser->known[id] == 0);
+
+	// The last entries are kept for the first of each well-known header,
+	// so these are always recorded. Other headers beyond are dropped.
+	if((parser->headerCount < REQ_MAX_HEADERS - REQ_KNOWN_HEADERS) || (first == TRUE))
+	{
+		struct req_header* header = &parser->headers[parser->headerCount++];
+		header->nameOff = parser->lineStart;
+		header->nameLen = nameLen;
+		header->valueOff = parser->lineStart + (value - line);
+		header->valueLen = valueLen;
+		if(first == TRUE)
+			parser->known[id] = parser->headerCount;
+	}
+
+	if(id < 0)
+		return TRUE;
+
+	if((id == REQ_HEADER_CONTENT_LENGTH) && (first == FALSE))
+	{
+		const struct req_header* earlier = &parser->headers[parser->known[id] - 1];
+		const char* base = line - parser->lineStart;
+		if((earlier->valueLen != valueLen) || (memcmp(&base[earlier->valueOff], value, valueLen) != 0))
+			return FALSE;
+	}
+
+	if(id == REQ_HEADER_CONNECTION)
+	{
+		if(_req_has_token(value, valueLen, "close") == TRUE)
+			parser->connectionClose = TRUE;
+		if(_req_has_token(value, valueLen, "keep-alive") == TRUE)
+			parser->connectionKeepAlive = TRUE;
+	}
+	else if(id == REQ_HEADER_ACCEPT_ENCODING)
+	{
+		if(_req_accepts_coding(value, valueLen, "gzip") == TRUE)
+			parser->acceptGzip = TRUE;
+	}
+	else if((id == REQ_HEADER_IF_MODIFIED_SINCE) && (first == TRUE))
+	{
+		parser->ifModifiedSince = _req_parse_http_date(value, valueLen);
+	}
+	else if((id == REQ_HEADER_IF_RANGE) && (first == TRUE))
+	{
+		parser->ifRangeDate = _req_parse_http_date(value, valueLen);
+	}
+	return TRUE;
+}
+
+/*
+ * Returns the REQ_HEADER_xxx of a header name, or -1 if it is not a
+ * well-known one.
+ */
+int _req_known_header(const char* name, size_t len)
+{
+	// The length (and where that is not enough, the first letter) tells
+	// which name it can only be
+	int id;
+	if(len == 4)
+		id = REQ_HEADER_HOST;
+	else if(len == 5)
+		id = REQ_HEADER_RANGE;
+	else if(len == 7)
+		id = REQ_HEADER_REFERER;
+	else if(len == 8)
+		id = REQ_HEADER_IF_RANGE;
+	else if(len == 10)
+		id = ((name[0] == 'C') || (name[0] == 'c')) ? REQ_HEADER_CONNECTION : REQ_HEADER_USER_AGENT;
+	else if(len == 13)
+		id = REQ_HEADER_IF_NONE_MATCH;
+	else if(len == 14)
+		id = REQ_HEADER_CONTENT_LENGTH;
+	else if(len == 15)
+		id = REQ_HEADER_ACCEPT_ENCODING;
+	else if(len == 17)
+		id = ((name[0] == 'I') || (name[0] == 'i')) ? REQ_HEADER_IF_MODIFIED_SINCE : REQ_HEADER_TRANSFER_ENCODING;
+	else
+		return -1;
+
+	return (strncasecmp(name, _req_known_names[id], len) == 0) ? id : -1;
+}
+
+/*
+ * Checks whether the comma-separated list 'value' contains 'token'
+ * (case-insensitive).
+ */
+BOOL _req_has_token(const char* value, size_t len, const char* token)
+{
+	size_t tokenLen = strlen(token);
+	size_t pos = 0;
+
+	while(pos < len)
+	{
+		// Skip separators
+		while((pos < len) && ((value[pos] == ' ') || (value[pos] == '\t') || (value[pos] == ',')))
+			++pos;
+
+		// Find the end of this element
+		size_t start = pos;
+		while((pos < len) && (value[pos] != ',') && (value[pos] != ' ') && (value[pos] != '\t'))
+			++pos;
+
+		if((pos - start == tokenLen) && (strncasecmp(&value[start], token, tokenLen) == 0))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Checks whether an Accept-Encoding value such as "gzip;q=0.8, br" accepts
+ * 'coding'. An element naming the coding decides; otherwise a "*" element
+ * does. Elements with a quality of 0 refuse the coding.
+ */
+BOOL _req_accepts_coding(const char* value, size_t len, const char* coding)
+{
+	size_t codingLen = strlen(coding);
+	int wildcard = -1; /* -1: no "*" element, else whether it accepts */
+	size_t pos = 0;
+
+	while(pos < len)
+	{
+		// Skip separators
+		while((pos < len) && ((value[pos] == ' ') || (value[pos] == '\t') || (value[pos] == ',')))
+			++pos;
+
+		// The coding name ends at a parameter or the next element
+		size_t start = pos;
+		while((pos < len) && (value[pos] != ',') && (value[pos] != ';') &&
+			(value[pos] != ' ') && (value[pos] != '\t'))
+			++pos;
+		size_t nameLen = pos - start;
+
+		// Parameters run up to the next element
+		size_t paramStart = pos;
+		while((pos < len) && (value[pos] != ','))
+			++pos;
+		BOOL accepted = (_req_zero_quality(&value[paramStart], pos - paramStart) == FALSE);
+
+		if((nameLen == codingLen) && (strncasecmp(&value[start], coding, codingLen) == 0))
+			return accepted;
+		if((nameLen == 1) && (value[start] == '*'))
+			wildcard = accepted;
+	}
+
+	return (wildcard == TRUE) ? TRUE : FALSE;
+}
+
+/*
+ * Returns TRUE if the parameters of a list element (";q=0" etc.) set its
+ * quality to zero.
+ */
+BOOL _req_zero_quality(const char* params, size_t len)
+{
+	size_t pos = 0;
+	while(pos < len)
+	{
+		// Find the next parameter
+		while((pos < len) && (params[pos] != ';'))
+			++pos;
+		if(pos == len)
+			break;
+		++pos;
+		while((pos < len) && ((params[pos] == ' ') || (params[pos] == '\t')))
+			++pos;
+
+		if((pos + 1 < len) && ((params[pos] == 'q') || (params[pos] == 'Q')) && (params[pos + 1] == '='))
+		{
+			// A quality value is zero if it has only zeros ("0", "0.000")
+			pos += 2;
+			if((pos == len) || (params[pos] != '0'))
+				return FALSE;
+			while((pos < len) && ((params[pos] == '0') || (params[pos] == '.')))
+				++pos;
+			return ((pos == len) || (params[pos] == ' ') || (params[pos] == '\t') ||
+				(params[pos] == ';')) ? TRUE : FALSE;
+		}
+	}
+	return FALSE;
+}
+
+/*
+ * Parses a date in the preferred HTTP format (IMF-fixdate, as sent in our
+ * Last-Modified headers and echoed by clients). Returns -1 for other or
+ * malformed dates.
+ */
+time_t _req_parse_http_date(const char* value, size_t len)
+{
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+	// Trailing white space is tolerated
+	while((len > 0) && ((value[len - 1] == ' ') || (value[len - 1] == '\t')))
+		--len;
+
+	// "Sun, 06 Nov 1994 08:49:37 GMT"
+	if((len != REQ_HTTP_DATE_LENGTH) || (value[3] != ',') || (value[4] != ' ') || (value[7] != ' ') ||
+		(value[11] != ' ') || (value[16] != ' ') || (value[19] != ':') || (value[22] != ':') ||
+		(strncmp(&value[25], " GMT", 4) != 0))
+		return -1;
+
+	int day, year, hour, minute, second;
+	if((_req_parse_number(&value[5], 2, &day) == FALSE) || (_req_parse_number(&value[12], 4, &year) == FALSE) ||
+		(_req_parse_number(&value[17], 2, &hour) == FALSE) || (_req_parse_number(&value[20], 2, &minute) == FALSE) ||
+		(_req_parse_number(&value[23], 2, &second) == FALSE))
+		return -1;
+
+	int month = 0;
+	while((month < 12) && (strncmp(&months[month * 3], &value[8], 3) != 0))
+		++month;
+	if((month == 12) || (day < 1) || (day > 31) || (hour > 23) || (minute > 59) || (second > 60))
+		return -1;
+
+	// Days since the epoch in the proleptic Gregorian calendar, counting
+	// years from March so the leap day comes last
+	int y = year - ((month < 2) ? 1 : 0);
+	int m = (month < 2) ? month + 10 : month - 2;
+	long days = 365L * y + y / 4 - y / 100 + y / 400 + (153 * m + 2) / 5 + day - 1 - 719468;
+
+	return (time_t) days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+/*
+ * Parses exactly 'len' decimal digits. Returns FALSE if there are others.
+ */
+BOOL _req_parse_number(const char* digits, size_t len, int* number)
+{
+	*number = 0;
+	size_t pos;
+	for(pos = 0; pos < len; ++pos)
+	{
+		if((digits[pos] < '0') || (digits[pos] > '9'))
+			return FALSE;
+		*number = *number * 10 + (digits[pos] - '0');
+	}
+	return TRUE;
+}
@@ -0,0 +1,144 @@
+/*
+ * request.h
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#ifndef REQUEST_H_
+#define REQUEST_H_
+
+#include "base.h"
+
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint16_t
+#include <time.h> // for time_t
+
+/**************************** Module types & constants ***********************/
+
+/* most headers recorded per request. Requests may have more; once the table
+ * is nearly full, only the first of each well-known header is recorded. */
+#define REQ_MAX_HEADERS 32
+
+/* the headers must end within this many bytes of the request's start, so
+ * they can be recorded with 16 bit offsets */
+#define REQ_MAX_HEADER_END 65535
+
+/*
+ * well-known headers, which are found without comparing names (see
+ * req_get_header())
+ */
+#define REQ_HEADER_HOST 0
+#define REQ_HEADER_CONNECTION 1
+#define REQ_HEADER_ACCEPT_ENCODING 2
+#define REQ_HEADER_IF_NONE_MATCH 3
+#define REQ_HEADER_IF_MODIFIED_SINCE 4
+#define REQ_HEADER_RANGE 5
+#define REQ_HEADER_IF_RANGE 6
+#define REQ_HEADER_USER_AGENT 7
+#define REQ_HEADER_REFERER 8
+#define REQ_HEADER_CONTENT_LENGTH 9
+#define REQ_HEADER_TRANSFER_ENCODING 10
+#define REQ_KNOWN_HEADERS 11
+
+/*
+ * a header of a request, as offsets into the request. The value is
+ * stripped of surrounding white space.
+ */
+struct req_header
+{
+	uint16_t nameOff;
+	uint16_t nameLen;
+	uint16_t valueOff;
+	uint16_t valueLen;
+};
+
+/*
+ * State of an incremental HTTP request parser. All positions are offsets
+ * into the caller's buffer, so the buffer may be moved (realloc'd) between
+ * calls to req_parse() as long as its contents are preserved.
+ */
+struct req_parser
+{
+	int state; /* internal parser state */
+	size_t scanPos; /* offset up to which the buffer has been scanned */
+	size_t lineStart; /* offset of the line currently being parsed */
+	size_t length; /* length of the whole request once complete */
+
+	size_t methodOff; /* request method */
+	size_t methodLen;
+	int method; /* REQ_METHOD_xxx */
+	size_t pathOff; /* path of the request target, without the query */
+	size_t pathLen;
+	size_t queryOff; /* query behind the '?', 0 if there is no '?' */
+	size_t queryLen;
+	int versionMajor; /* HTTP version, 1.0 if none was given */
+	int versionMinor;
+
+	BOOL connectionClose; /* "Connection: close" was sent */
+	BOOL connectionKeepAlive; /* "Connection: keep-alive" was sent */
+	BOOL acceptGzip; /* the client accepts "Content-Encoding: gzip" */
+	time_t ifModifiedSince; /* date of If-Modified-Since, -1 if none or invalid */
+	time_t ifRangeDate; /* If-Range as a date, -1 if none or an entity tag */
+
+	unsigned char known[REQ_KNOWN_HEADERS]; /* 1 + index of the first header of each well-known one, 0 if none */
+	int headerCount;
+	struct req_header headers[REQ_MAX_HEADERS]; /* the headers in the order received (kept last, see req_init()) */
+};
+
+/*
+ * these constants are returned by req_parse().
+ */
+extern const int REQ_COMPLETE;
+extern const int REQ_INCOMPLETE;
+extern const int REQ_BAD_REQUEST;
+
+/*
+ * request methods (parser->method). Methods other than GET and HEAD are
+ * reported as REQ_METHOD_OTHER.
+ */
+extern const int REQ_METHOD_GET;
+extern const int REQ_METHOD_HEAD;
+extern const int REQ_METHOD_OTHER;
+
+/**************************** Module interface *******************************/
+
+/*
+ * (Re-)Initializes a parser for a new request.
+ */
+void req_init(struct req_parser* parser);
+
+/*
+ * Continues parsing 'buf', which holds 'len' bytes received so far. Bytes
+ * which have already been scanned by a previous call are not looked at again.
+ * Return values:
+ * - REQ_COMPLETE : the request line and all headers have been received; the
+ *                  request occupies the first parser->length bytes of buf.
+ * - REQ_INCOMPLETE : more data is needed.
+ * - REQ_BAD_REQUEST : the request is malformed or has headers beyond
+ *                     REQ_MAX_HEADER_END.
+ */
+int req_parse(struct req_parser* parser, const char* buf, size_t len);
+
+/*
+ * Returns TRUE if the client wants the connection to be kept open after
+ * the response. Only meaningful after req_parse() returned REQ_COMPLETE.
+ */
+BOOL req_keep_alive(const struct req_parser* parser);
+
+/*
+ * Returns the value of the first well-known header 'id' (REQ_HEADER_xxx)
+ * of the request in 'buf' and sets *len to its length, or returns NULL if
+ * the request has no such header. The value is not NUL-terminated.
+ */
+const char* req_get_header(const struct req_parser* parser, const char* buf, int id, size_t* len);
+
+/*
+ * Like req_get_header(), but for a header given by its name, which is
+ * compared case-insensitively. Headers which did not fit in the table
+ * (see REQ_MAX_HEADERS) are not found.
+ */
+const char* req_find_header(const struct req_parser* parser, const char* buf, const char* name, size_t* len);
+
+#endif /* REQUEST_H_ */
@@ -3,6 +3,11 @@
  *
  * This file contains the module 'resources'. It is responsible
  * for loading external files and reading their length and mime type.
+ * Small files are kept in an in-memory content cache with LRU eviction.
+ * Clients accepting gzip get a precompressed 'file.gz' sibling if there is
+ * one, or (with compression enabled) a copy compressed on first request.
+ * Optionally, the www tree is indexed at startup and the index is kept
+ * current with inotify, so lookups need not ask the file system.
  *
  *  Created on: 09.01.2010
  *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
@@ -10,21 +15,142 @@
  */
 
 #include "base.h"
+#include "metrics.h"
+#include "mimetypes.h"
 #include "resources.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+/**************************** Local types ************************************/
+
+/*
+ * a cache entry: the metadata of a file plus either its contents (small
+ * files) or an open fd (large files). Entries are reference counted: the
+ * cache holds one reference while the entry is in the table, and each
+ * resource handed out holds another one. Files which are not cached get an
+ * entry, too, which is freed when the resource is released.
+ */
+struct _res_cache_entry
+{
+	char* path; /* request path (key) */
+	unsigned int hash;
+	int variant; /* RES_VARIANT_IDENTITY or RES_VARIANT_GZIP (part of the key) */
+	char* filePath; /* request path of the file the entry was made from */
+	off_t fileSize; /* size of that file; differs from 'len' if compressed here */
+	BOOL noGzip; /* identity entries: there is no gzip variant to serve */
+
+	int fd; /* open file, -1 if the contents are in 'data' */
+	char* data; /* file contents, NULL if served from 'fd' */
+	off_t len;
+	const char* mime; /* owned by the mime type registry */
+	char* header; /* serialized entity headers */
+	size_t headerLen;
+	size_t typeOff; /* end of the Content-Length line */
+	size_t validatorsOff; /* start of the headers repeated in 304 responses */
+	size_t etagOff; /* the entity tag within 'header' */
+	size_t etagLen;
+	mode_t mode;
+	time_t mtime;
+	dev_t dev; /* identity of the file that was opened */
+	ino_t ino;
+	time_t validated; /* last time the file was checked for changes */
+
+	int refs;
+
+	struct _res_cache_entry* hashNext;
+	struct _res_cache_entry* lruPrev; /* towards more recently used */
+	struct _res_cache_entry* lruNext; /* towards less recently used */
+};
+
+/*
+ * a list of cache entries, most recently used first
+ */
+struct _res_lru_list
+{
+	struct _res_cache_entry* head;
+	struct _res_cache_entry* tail;
+};
+
+/*
+ * an entry of the file index: the status of a file or directory below the
+ * www path, keyed by its path relative to it (without leading slash; the
+ * www path itself has the empty path)
+ */
+struct _res_index_entry
+{
+	char* path;
+	unsigned int hash;
+	int access; /* RES_OK, or RES_ACCESS_DENIED if it may not be served */
+	BOOL tree; /* a directory whose contents are indexed (and watched) */
+	off_t size;
+	mode_t mode;
+	time_t mtime;
+	dev_t dev;
+	ino_t ino;
+
+	struct _res_index_entry* next;
+};
+
 /**************************** Prototypes *************************************/
 
-int _res_file_accessable(const char* path);
+struct _res_cache_entry* _res_get(const char* path, unsigned int hash, int* error);
+struct _res_cache_entry* _res_get_gzip(struct _res_cache_entry* identity);
+struct _res_cache_entry* _res_new_entry(const char* path, unsigned int hash, int variant);
+struct _res_cache_entry* _res_load(const char* path, unsigned int hash, int* error);
+struct _res_cache_entry* _res_load_gzip_sibling(struct _res_cache_entry* identity);
+struct _res_cache_entry* _res_compress(struct _res_cache_entry* identity);
+int _res_open(const char* filePath, struct _res_cache_entry* entry);
+BOOL _res_prepare(struct _res_cache_entry* entry);
+BOOL _res_read_contents(struct _res_cache_entry* entry);
+BOOL _res_build_header(struct _res_cache_entry* entry);
+BOOL _res_compressible(const char* mime);
+void _res_fill_resource(struct res_resource* resinfo, struct _res_cache_entry* entry);
+struct _res_cache_entry* _res_cache_find(const char* path, unsigned int hash, int variant);
+BOOL _res_cache_hit(struct _res_cache_entry* entry);
+BOOL _res_cache_validate(struct _res_cache_entry* entry);
+void _res_cache_insert(struct _res_cache_entry* entry);
+void _res_cache_evict(struct _res_cache_entry* entry);
+struct _res_lru_list* _res_lru_of(struct _res_cache_entry* entry);
+void _res_lru_unlink(struct _res_lru_list* list, struct _res_cache_entry* entry);
+void _res_lru_push_front(struct _res_lru_list* list, struct _res_cache_entry* entry);
+void _res_cache_unref(struct _res_cache_entry* entry);
+unsigned int _res_hash(const char* path);
+int _res_stat(const char* filePath, struct stat* s);
+int _res_file_accessable(const char* path, struct stat* s);
+int _res_file_access(const struct stat* s);
 BOOL _res_dir_accessable(const char* path);
 BOOL _res_sufficient_rights(const mode_t mode, const uid_t uid, const gid_t gid);
-BOOL _res_known_file_type(const char* file, struct res_resource* resinfo);
-char *_res_get_real_path(const char* relPath);
+BOOL _res_get_real_path(const char* relPath, char* buf, size_t size);
+char* _res_join(const char* dir, const char* name, const char* suffix);
+BOOL _res_index_rebuild(void);
+void _res_index_clear(void);
+void _res_index_disable(void);
+BOOL _res_index_dir(const char* relDir);
+BOOL _res_index_refresh(const char* relPath);
+BOOL _res_index_refresh_dir(int wd);
+struct _res_index_entry* _res_index_find(const char* path);
+struct _res_index_entry* _res_index_get(const char* relPath, unsigned int hash);
+struct _res_index_entry* _res_index_add(const char* relPath, unsigned int hash);
+void _res_index_remove(struct _res_index_entry* entry);
+void _res_index_prune(const char* relDir);
+BOOL _res_index_grow(void);
+BOOL _res_watch_add(int wd, const char* relDir);
+void _res_watch_remove(int wd);
 
 /**************************** Global constants *******************************/
 
@@ -35,6 +161,37 @@ const int RES_INVALID_PATH = 3;
 const int RES_ACCESS_DENIED = 4;
 const int RES_IO_ERROR = 5;
 
+/**************************** Local constants ********************************/
+
+/* number of hash buckets of the content cache (power of two) */
+#define RES_CACHE_BUCKETS 1024
+
+/* default memory budget of the content cache */
+#define RES_DEFAULT_CACHE_SIZE (16 * 1024 * 1024)
+
+/* files larger than this are never cached */
+#define RES_CACHE_MAX_FILE_SIZE (1024 * 1024)
+
+/* number of open fds of large files kept in the cache */
+#define RES_FD_CACHE_SIZE 256
+
+/* seconds after which a cached file is checked for modification */
+#define RES_CACHE_REVALIDATE_INTERVAL 1
+
+/* initial number of hash buckets of the file index (power of two) */
+#define RES_INDEX_INITIAL_BUCKETS 1024
+
+/* changes to a directory of the www tree which update the index */
+#define RES_INDEX_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | \
+		IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+/* size of the buffer inotify events are read into */
+#define RES_INDEX_EVENT_BUFFER 4096
+
+/* content codings of cache entries */
+#define RES_VARIANT_IDENTITY 0
+#define RES_VARIANT_GZIP 1
+
 /**************************** Local variables ********************************/
 
 /* the global www path */
@@ -43,6 +200,33 @@ char* _res_www_path;
 /* length of the www path */
 int _res_www_path_len;
 
+/* the cache: one hash table for all entries */
+struct _res_cache_entry* _res_cache_table[RES_CACHE_BUCKETS];
+
+/* entries holding file contents, and the memory they use */
+struct _res_lru_list _res_mem_lru = { NULL, NULL };
+size_t _res_cache_used = 0;
+size_t _res_cache_budget = RES_DEFAULT_CACHE_SIZE;
+
+/* entries holding an open fd, and their number */
+struct _res_lru_list _res_fd_lru = { NULL, NULL };
+int _res_fd_cached = 0;
+
+/* whether files without a .gz sibling are compressed on first request (off unless set) */
+BOOL _res_compression;
+
+/* the file index (NULL unless it is used), its number of buckets and entries */
+struct _res_index_entry** _res_index_table;
+unsigned int _res_index_buckets;
+unsigned int _res_index_count;
+
+/* the inotify instance keeping the index current */
+int _res_index_fd = -1;
+
+/* the directory (relative path) watched by each watch descriptor, or NULL */
+char** _res_watch_dirs;
+int _res_watch_capacity;
+
 /**************************** Module interface *******************************/
 
 int res_set_www_path(char* path)
@@ -56,13 +240,18 @@ int res_set_www_path(char* path)
 	if(path[pathLen-1] != '/')
 	{
 		_res_www_path = malloc(pathLen + 2);
+		if(_res_www_path == NULL)
+			return RES_IO_ERROR;
 		strcpy(_res_www_path, path);
 		_res_www_path[pathLen] = '/';
+		_res_www_path[pathLen + 1] = '\0';
 		_res_www_path_len = pathLen + 1;
 	}
 	else
 	{
 		_res_www_path = malloc(pathLen + 1);
+		if(_res_www_path == NULL)
+			return RES_IO_ERROR;
 		strcpy(_res_www_path, path);
 		_res_www_path_len = pathLen;
 	}
@@ -70,71 +259,796 @@ int res_set_www_path(char* path)
 	return RES_OK;
 }
 
-int res_lookup(const char* path, struct res_resource* resinfo)
+void res_set_cache_size(size_t size)
+{
+	_res_cache_budget = size;
+}
+
+void res_set_compression(BOOL enabled)
+{
+	_res_compression = enabled;
+}
+
+int res_build_index(void)
+{
+	_res_index_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(_res_index_fd < 0)
+		return RES_IO_ERROR;
+
+	if(_res_index_rebuild() == FALSE)
+	{
+		_res_index_disable();
+		return RES_IO_ERROR;
+	}
+
+	return RES_OK;
+}
+
+int res_get_index_fd(void)
+{
+	return (_res_index_table != NULL) ? _res_index_fd : -1;
+}
+
+void res_update_index(void)
+{
+	char buf[RES_INDEX_EVENT_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	if(_res_index_table == NULL)
+		return;
+
+	for(;;)
+	{
+		ssize_t len = read(_res_index_fd, buf, sizeof(buf));
+		if(len < 0 && errno == EINTR)
+			continue;
+		if(len <= 0)
+			break;
+
+		ssize_t pos = 0;
+		while(pos < len)
+		{
+			struct inotify_event* event = (struct inotify_event*) &buf[pos];
+			pos += sizeof(struct inotify_event) + event->len;
+
+			BOOL ok = TRUE;
+			if(event->mask & IN_Q_OVERFLOW)
+			{
+				// Events were lost, so nothing in the index can be trusted
+				ok = _res_index_rebuild();
+			}
+			else if(event->mask & IN_IGNORED)
+			{
+				// The directory is gone, or its watch was removed. A linked
+				// directory may go without its link, so the path is checked.
+				if((event->wd < _res_watch_capacity) && (_res_watch_dirs[event->wd] != NULL))
+					ok = _res_index_refresh_dir(event->wd);
+				_res_watch_remove(event->wd);
+			}
+			else if((event->len > 0) && (event->wd < _res_watch_capacity) &&
+				(_res_watch_dirs[event->wd] != NULL))
+			{
+				// Whatever happened to the file, its current status tells
+				char* relPath = _res_join(_res_watch_dirs[event->wd], event->name, "");
+				ok = (relPath != NULL) && (_res_index_refresh(relPath) == TRUE);
+				free(relPath);
+			}
+
+			if(ok == FALSE)
+			{
+				fprintf(stderr, "Error: Could not update the file index, looking files up in the file system from now on.\n");
+				_res_index_disable();
+				return;
+			}
+		}
+	}
+}
+
+int res_lookup(const char* path, BOOL acceptGzip, struct res_resource* resinfo)
 {
 	// Check for forbidden .. in path
 	if(strstr(path, "..") != NULL)
 		return RES_INVALID_PATH;
 
-	// Build full path
-	char* realPath = _res_get_real_path(path);
+	// The plain file decides whether the resource exists and may be served
+	unsigned int hash = _res_hash(path);
+	int error;
+	struct _res_cache_entry* entry = _res_get(path, hash, &error);
+	if(entry == NULL)
+		return error;
+
+	// Prefer the compressed variant if the client accepts it
+	if((acceptGzip == TRUE) && (entry->noGzip == FALSE))
+	{
+		struct _res_cache_entry* gzEntry = _res_get_gzip(entry);
+		if(gzEntry != NULL)
+		{
+			_res_cache_unref(entry);
+			entry = gzEntry;
+		}
+	}
+
+	_res_fill_resource(resinfo, entry);
+	return RES_OK;
+}
+
+void res_release(struct res_resource* resinfo)
+{
+	if(resinfo->cacheRef != NULL)
+		_res_cache_unref(resinfo->cacheRef);
+
+	resinfo->fd = -1;
+	resinfo->data = NULL;
+	resinfo->header = NULL;
+	resinfo->headerLen = 0;
+	resinfo->etag = NULL;
+	resinfo->cacheRef = NULL;
+}
+
+void res_release_ref(void* cacheRef)
+{
+	_res_cache_unref(cacheRef);
+}
+
+void res_clean_up(void)
+{
+	// Empty the cache. Entries still in use are freed on release.
+	while(_res_mem_lru.head != NULL)
+		_res_cache_evict(_res_mem_lru.head);
+	while(_res_fd_lru.head != NULL)
+		_res_cache_evict(_res_fd_lru.head);
+
+	_res_index_disable();
+	if(_res_index_fd >= 0)
+		close(_res_index_fd);
+
+	free(_res_www_path);
+}
+
+/**************************** Local methods **********************************/
+
+/*
+ * Returns the (identity) entry for 'path' from the cache, loading and
+ * caching it if necessary. The caller gets a reference to it. Returns NULL
+ * and sets 'error' to one of the values of res_lookup() on failure.
+ */
+struct _res_cache_entry* _res_get(const char* path, unsigned int hash, int* error)
+{
+	struct _res_cache_entry* entry = _res_cache_find(path, hash, RES_VARIANT_IDENTITY);
+	if(_res_cache_hit(entry) == TRUE)
+	{
+		met_count_cache(TRUE);
+		return entry;
+	}
+
+	entry = _res_load(path, hash, error);
+	if(entry == NULL)
+		return NULL;
+
+	met_count_cache(FALSE);
+	_res_cache_insert(entry);
+	return entry;
+}
 
+/*
+ * Returns the gzip variant of an identity entry (with a reference for the
+ * caller), loading and caching it if necessary. Returns NULL if there is
+ * none, which is remembered in the identity entry until it is reloaded.
+ */
+struct _res_cache_entry* _res_get_gzip(struct _res_cache_entry* identity)
+{
+	struct _res_cache_entry* entry = _res_cache_find(identity->path, identity->hash, RES_VARIANT_GZIP);
+	if(entry != NULL)
+	{
+		// A variant older than the file itself is stale
+		if(entry->mtime < identity->mtime)
+			_res_cache_evict(entry);
+		else if(_res_cache_hit(entry) == TRUE)
+			return entry;
+	}
+
+	entry = _res_load_gzip_sibling(identity);
+	if(entry == NULL)
+		entry = _res_compress(identity);
+	if(entry == NULL)
+	{
+		identity->noGzip = TRUE;
+		return NULL;
+	}
+
+	_res_cache_insert(entry);
+	return entry;
+}
+
+/*
+ * Creates an empty (uncached) entry holding one reference.
+ * Returns NULL if out of memory.
+ */
+struct _res_cache_entry* _res_new_entry(const char* path, unsigned int hash, int variant)
+{
+	struct _res_cache_entry* entry = malloc(sizeof(struct _res_cache_entry));
+	if(entry == NULL)
+		return NULL;
+	memset(entry, 0, sizeof(struct _res_cache_entry));
+	entry->fd = -1;
+	entry->refs = 1;
+
+	entry->path = malloc(strlen(path) + 1);
+	if(entry->path == NULL)
+	{
+		_res_cache_unref(entry);
+		return NULL;
+	}
+	strcpy(entry->path, path);
+	entry->hash = hash;
+	entry->variant = variant;
+	return entry;
+}
+
+/*
+ * Opens the file for the request path 'path' and creates an (uncached)
+ * entry for it holding one reference. Small files are read into memory
+ * right away. Returns NULL and sets 'error' to one of the values of
+ * res_lookup() on failure.
+ */
+struct _res_cache_entry* _res_load(const char* path, unsigned int hash, int* error)
+{
+	struct _res_cache_entry* entry = _res_new_entry(path, hash, RES_VARIANT_IDENTITY);
+	if(entry == NULL)
+	{
+		*error = RES_IO_ERROR;
+		return NULL;
+	}
+
+	*error = _res_open(path, entry);
+	if(*error != RES_OK)
+	{
+		_res_cache_unref(entry);
+		return NULL;
+	}
+
+	if(_res_prepare(entry) == FALSE)
+	{
+		_res_cache_unref(entry);
+		*error = RES_IO_ERROR;
+		return NULL;
+	}
+
+	return entry;
+}
+
+/*
+ * Creates a gzip entry from the precompressed sibling 'path.gz' of an
+ * identity entry. Siblings older than the file itself are ignored.
+ * Returns NULL if there is no usable sibling.
+ */
+struct _res_cache_entry* _res_load_gzip_sibling(struct _res_cache_entry* identity)
+{
+	char gzPath[PATH_MAX];
+	if(snprintf(gzPath, sizeof(gzPath), "%s.gz", identity->path) >= (int) sizeof(gzPath))
+		return NULL;
+
+	struct _res_cache_entry* entry = _res_new_entry(identity->path, identity->hash, RES_VARIANT_GZIP);
+	if(entry == NULL)
+		return NULL;
+
+	int error = _res_open(gzPath, entry);
+	if((error != RES_OK) || (entry->mtime < identity->mtime) || (_res_prepare(entry) == FALSE))
+	{
+		_res_cache_unref(entry);
+		return NULL;
+	}
+
+	return entry;
+}
+
+/*
+ * Compresses the in-memory contents of an identity entry into a new gzip
+ * entry, which is validated against the same file. Returns NULL if
+ * compression is disabled, the file is not in memory or of a type that
+ * does not compress, or compressing does not make it smaller.
+ */
+struct _res_cache_entry* _res_compress(struct _res_cache_entry* identity)
+{
+#ifdef USE_ZLIB
+	if((_res_compression == FALSE) || (identity->data == NULL) ||
+		(_res_compressible(identity->mime) == FALSE))
+		return NULL;
+
+	// windowBits + 16 selects the gzip format
+	z_stream stream;
+	memset(&stream, 0, sizeof(z_stream));
+	if(deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return NULL;
+
+	uLong bound = deflateBound(&stream, identity->len);
+	char* data = malloc(bound);
+	if(data == NULL)
+	{
+		deflateEnd(&stream);
+		return NULL;
+	}
+
+	stream.next_in = (Bytef*) identity->data;
+	stream.avail_in = identity->len;
+	stream.next_out = (Bytef*) data;
+	stream.avail_out = bound;
+	int result = deflate(&stream, Z_FINISH);
+	off_t len = stream.total_out;
+	deflateEnd(&stream);
+
+	if((result != Z_STREAM_END) || (len >= identity->len))
+	{
+		free(data);
+		return NULL;
+	}
+
+	struct _res_cache_entry* entry = _res_new_entry(identity->path, identity->hash, RES_VARIANT_GZIP);
+	if(entry == NULL)
+	{
+		free(data);
+		return NULL;
+	}
+
+	char* shrunk = realloc(data, (len > 0) ? len : 1);
+	entry->data = (shrunk != NULL) ? shrunk : data;
+	entry->len = len;
+
+	// Take over the identity of the original file, so it is validated against it
+	entry->filePath = malloc(strlen(identity->filePath) + 1);
+	if(entry->filePath == NULL)
+	{
+		_res_cache_unref(entry);
+		return NULL;
+	}
+	strcpy(entry->filePath, identity->filePath);
+	entry->fileSize = identity->fileSize;
+	entry->mime = identity->mime;
+	entry->mode = identity->mode;
+	entry->mtime = identity->mtime;
+	entry->dev = identity->dev;
+	entry->ino = identity->ino;
+	entry->validated = identity->validated;
+
+	if(_res_build_header(entry) == FALSE)
+	{
+		_res_cache_unref(entry);
+		return NULL;
+	}
+
+	return entry;
+#else
+	return NULL;
+#endif
+}
+
+/*
+ * Checks the file at the request path 'filePath' and opens it. On success,
+ * the entry's fd, file path and file status are set, and its mime type is
+ * taken from the entry's request path. Returns the same values as
+ * res_lookup().
+ */
+int _res_open(const char* filePath, struct _res_cache_entry* entry)
+{
 	// Check for existance and access rights
-	int access = _res_file_accessable(realPath);
+	struct stat s;
+	int access = _res_stat(filePath, &s);
 	if(access != RES_OK)
 		return access;
 
 	// Get mime type
-	if(_res_known_file_type(realPath, resinfo) == FALSE)
-	{
-		free(realPath);
+	entry->mime = mime_lookup(entry->path);
+	if(entry->mime == NULL)
 		return RES_UNKNOWN_FILE_TYPE;
-	}
 
 	// Open file
-	resinfo->file = fopen(realPath, "r");
-	if(resinfo->file == NULL)
-	{
+	char realPath[PATH_MAX];
+	if(_res_get_real_path(filePath, realPath, sizeof(realPath)) == FALSE)
+		return RES_IO_ERROR;
+	entry->fd = open(realPath, O_RDONLY | O_CLOEXEC);
+	if(entry->fd < 0)
+		return RES_IO_ERROR;
 
-		free(realPath);
+	// Take the status of what was actually opened
+	if(fstat(entry->fd, &s) != 0)
 		return RES_IO_ERROR;
-	}
 
-	// Determine the file length
-	fseek(resinfo->file, 0, SEEK_END);
-	resinfo->len = ftell(resinfo->file);
-	fseek(resinfo->file, 0, SEEK_SET);
+	entry->filePath = malloc(strlen(filePath) + 1);
+	if(entry->filePath == NULL)
+		return RES_IO_ERROR;
+	strcpy(entry->filePath, filePath);
 
+	entry->len = s.st_size;
+	entry->fileSize = s.st_size;
+	entry->mode = s.st_mode;
+	entry->mtime = s.st_mtime;
+	entry->dev = s.st_dev;
+	entry->ino = s.st_ino;
+	entry->validated = time(NULL);
 	return RES_OK;
 }
 
-void res_clean_up(void)
+/*
+ * Serializes the headers of a freshly opened entry and keeps small files in
+ * memory. If reading the file fails, the fd is used instead.
+ * Returns FALSE if out of memory.
+ */
+BOOL _res_prepare(struct _res_cache_entry* entry)
 {
-	free(_res_www_path);
+	// Serialize the headers once for all responses from this entry
+	if(_res_build_header(entry) == FALSE)
+		return FALSE;
+
+	// Keep small files in memory
+	if((_res_cache_budget > 0) && (entry->len <= RES_CACHE_MAX_FILE_SIZE) &&
+		(entry->len <= _res_cache_budget))
+		_res_read_contents(entry);
+
+	return TRUE;
 }
 
-/**************************** Local methods **********************************/
+/*
+ * Reads the whole file of an entry into memory and closes its fd.
+ * Returns FALSE (leaving the entry alone) if that fails.
+ */
+BOOL _res_read_contents(struct _res_cache_entry* entry)
+{
+	char* data = malloc((entry->len > 0) ? entry->len : 1);
+	if(data == NULL)
+		return FALSE;
+
+	off_t pos = 0;
+	while(pos < entry->len)
+	{
+		ssize_t bytesRead = pread(entry->fd, &data[pos], entry->len - pos, pos);
+		if((bytesRead < 0) && (errno == EINTR))
+			continue;
+		if(bytesRead <= 0)
+		{
+			free(data);
+			return FALSE;
+		}
+		pos += bytesRead;
+	}
+
+	close(entry->fd);
+	entry->fd = -1;
+	entry->data = data;
+	return TRUE;
+}
 
 /*
- * Checks for existance of a file and whether it is readable.
- * Checks that it actually is a file, too.
- * Returns RES_OK on success, RES_FILE_NOT_FOUND or RES_ACCESS_DENIED else.
+ * Serializes the entity headers describing an entry's file. They start
+ * with Content-Length, which partial responses replace, and end with the
+ * validators (Vary, ETag and Last-Modified), which are all that is
+ * repeated in 304 responses. The entity tag is made from the identity,
+ * size and modification time of the file the entry was made from.
+ * Returns FALSE if out of memory.
+ */
+BOOL _res_build_header(struct _res_cache_entry* entry)
+{
+	// Caches must keep the variants of compressible files apart
+	const char* encoding = "";
+	const char* vary = "";
+	if(entry->variant == RES_VARIANT_GZIP)
+	{
+		encoding = "Content-Encoding: gzip\r\n";
+		vary = "Vary: Accept-Encoding\r\n";
+	}
+	else if(_res_compressible(entry->mime) == TRUE)
+	{
+		vary = "Vary: Accept-Encoding\r\n";
+	}
+
+	char etag[64];
+	int etagLen = snprintf(etag, sizeof(etag), "\"%llx-%llx-%llx%s\"", (unsigned long long) entry->ino,
+			(unsigned long long) entry->fileSize, (unsigned long long) entry->mtime,
+			(entry->variant == RES_VARIANT_GZIP) ? "-gz" : "");
+
+	char date[32];
+	struct tm tm;
+	if((gmtime_r(&entry->mtime, &tm) == NULL) ||
+		(strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm) == 0))
+		return FALSE;
+
+	char buf[256];
+	int typeOff = snprintf(buf, sizeof(buf), "Content-Length: %lld\r\n", (long long) entry->len);
+	int validatorsOff = typeOff + snprintf(&buf[typeOff], sizeof(buf) - typeOff,
+			"Content-Type: %s\r\n%sAccept-Ranges: bytes\r\n", entry->mime, encoding);
+	if((validatorsOff < typeOff) || (validatorsOff >= (int) sizeof(buf)))
+		return FALSE;
+	int len = validatorsOff + snprintf(&buf[validatorsOff], sizeof(buf) - validatorsOff,
+			"%sETag: %s\r\nLast-Modified: %s\r\n", vary, etag, date);
+	if((len < validatorsOff) || (len >= (int) sizeof(buf)))
+		return FALSE;
+
+	entry->header = malloc(len + 1);
+	if(entry->header == NULL)
+		return FALSE;
+
+	memcpy(entry->header, buf, len + 1);
+	entry->headerLen = len;
+	entry->typeOff = typeOff;
+	entry->validatorsOff = validatorsOff;
+	entry->etagOff = validatorsOff + strlen(vary) + strlen("ETag: ");
+	entry->etagLen = etagLen;
+	return TRUE;
+}
+
+/*
+ * Returns TRUE for mime types worth compressing (text).
+ */
+BOOL _res_compressible(const char* mime)
+{
+	if(strncmp(mime, "text/", 5) == 0)
+		return TRUE;
+	if((strcmp(mime, "image/svg+xml") == 0) || (strcmp(mime, "application/json") == 0) ||
+		(strcmp(mime, "application/xml") == 0) || (strcmp(mime, "application/xhtml+xml") == 0) ||
+		(strcmp(mime, "application/javascript") == 0))
+		return TRUE;
+	return FALSE;
+}
+
+/*
+ * Fills a resource struct from an entry. The caller's reference to the
+ * entry is handed over to the resource.
+ */
+void _res_fill_resource(struct res_resource* resinfo, struct _res_cache_entry* entry)
+{
+	resinfo->fd = entry->fd;
+	resinfo->data = entry->data;
+	resinfo->mime = entry->mime;
+	resinfo->len = entry->len;
+	resinfo->header = entry->header;
+	resinfo->headerLen = entry->headerLen;
+	resinfo->typeOff = entry->typeOff;
+	resinfo->validatorsOff = entry->validatorsOff;
+	resinfo->etag = &entry->header[entry->etagOff];
+	resinfo->etagLen = entry->etagLen;
+	resinfo->mtime = entry->mtime;
+	resinfo->cacheRef = entry;
+}
+
+/*
+ * Finds the cache entry for a variant of 'path'. Returns NULL if there is
+ * none.
+ */
+struct _res_cache_entry* _res_cache_find(const char* path, unsigned int hash, int variant)
+{
+	struct _res_cache_entry* entry = _res_cache_table[hash & (RES_CACHE_BUCKETS - 1)];
+	while(entry != NULL)
+	{
+		if((entry->hash == hash) && (entry->variant == variant) && (strcmp(entry->path, path) == 0))
+			return entry;
+		entry = entry->hashNext;
+	}
+	return NULL;
+}
+
+/*
+ * Takes a reference to a cached entry (which may be NULL) if it is still
+ * valid and marks it most recently used. Returns FALSE if the entry cannot
+ * be used.
  */
-int _res_file_accessable(const char* path)
+BOOL _res_cache_hit(struct _res_cache_entry* entry)
 {
+	if((entry == NULL) || (_res_cache_validate(entry) == FALSE))
+		return FALSE;
+
+	// Most recently used
+	struct _res_lru_list* list = _res_lru_of(entry);
+	_res_lru_unlink(list, entry);
+	_res_lru_push_front(list, entry);
+
+	++entry->refs;
+	return TRUE;
+}
+
+/*
+ * Makes sure a cache entry still matches the file on disk, checking at
+ * most once every RES_CACHE_REVALIDATE_INTERVAL seconds. If the file has
+ * been changed, replaced, removed or made unreadable, the entry is evicted
+ * and FALSE is returned.
+ */
+BOOL _res_cache_validate(struct _res_cache_entry* entry)
+{
+	// Asking the index costs nothing, so it is asked every time
+	time_t now = time(NULL);
+	if((_res_index_table == NULL) && (now - entry->validated < RES_CACHE_REVALIDATE_INTERVAL))
+		return TRUE;
+
 	struct stat s;
-	if(stat(path, &s) != 0)
+	int access = _res_stat(entry->filePath, &s);
+
+	if((access != RES_OK) || (s.st_size != entry->fileSize) || (s.st_mtime != entry->mtime) ||
+		(s.st_dev != entry->dev) || (s.st_ino != entry->ino))
 	{
-		return RES_FILE_NOT_FOUND;
+		_res_cache_evict(entry);
+		return FALSE;
+	}
+
+	entry->mode = s.st_mode;
+	entry->validated = now;
+	return TRUE;
+}
+
+/*
+ * Adds a new entry to the cache, evicting least recently used entries of
+ * the same kind until it fits. Entries which can never fit are not added.
+ */
+void _res_cache_insert(struct _res_cache_entry* entry)
+{
+	if(entry->data != NULL)
+	{
+		while((_res_mem_lru.tail != NULL) && (_res_cache_used + entry->len > _res_cache_budget))
+			_res_cache_evict(_res_mem_lru.tail);
+		if(_res_cache_used + entry->len > _res_cache_budget)
+			return;
+		_res_cache_used += entry->len;
 	}
 	else
 	{
-		if((s.st_mode & S_IFREG) &&
-			(_res_sufficient_rights(s.st_mode, s.st_uid, s.st_gid) == TRUE))
-			return RES_OK;
-		else
-			return RES_ACCESS_DENIED;
+		while((_res_fd_lru.tail != NULL) && (_res_fd_cached >= RES_FD_CACHE_SIZE))
+			_res_cache_evict(_res_fd_lru.tail);
+		if(_res_fd_cached >= RES_FD_CACHE_SIZE)
+			return;
+		++_res_fd_cached;
 	}
+
+	// Insert into the table and at the front of the LRU list
+	int bucket = entry->hash & (RES_CACHE_BUCKETS - 1);
+	entry->hashNext = _res_cache_table[bucket];
+	_res_cache_table[bucket] = entry;
+	_res_lru_push_front(_res_lru_of(entry), entry);
+
+	// The cache holds a reference of its own
+	++entry->refs;
+}
+
+/*
+ * Removes an entry from the table and its LRU list and drops the cache's
+ * reference to it.
+ */
+void _res_cache_evict(struct _res_cache_entry* entry)
+{
+	// Unlink from the hash chain
+	struct _res_cache_entry** link = &_res_cache_table[entry->hash & (RES_CACHE_BUCKETS - 1)];
+	while(*link != entry)
+		link = &(*link)->hashNext;
+	*link = entry->hashNext;
+
+	_res_lru_unlink(_res_lru_of(entry), entry);
+
+	if(entry->data != NULL)
+		_res_cache_used -= entry->len;
+	else
+		--_res_fd_cached;
+
+	_res_cache_unref(entry);
+}
+
+/*
+ * Returns the LRU list an entry belongs on.
+ */
+struct _res_lru_list* _res_lru_of(struct _res_cache_entry* entry)
+{
+	return (entry->data != NULL) ? &_res_mem_lru : &_res_fd_lru;
+}
+
+/*
+ * Removes an entry from an LRU list.
+ */
+void _res_lru_unlink(struct _res_lru_list* list, struct _res_cache_entry* entry)
+{
+	if(entry->lruPrev != NULL)
+		entry->lruPrev->lruNext = entry->lruNext;
+	else
+		list->head = entry->lruNext;
+	if(entry->lruNext != NULL)
+		entry->lruNext->lruPrev = entry->lruPrev;
+	else
+		list->tail = entry->lruPrev;
+
+	entry->lruPrev = NULL;
+	entry->lruNext = NULL;
+}
+
+/*
+ * Inserts an entry at the front (most recently used) of an LRU list.
+ */
+void _res_lru_push_front(struct _res_lru_list* list, struct _res_cache_entry* entry)
+{
+	entry->lruPrev = NULL;
+	entry->lruNext = list->head;
+	if(list->head != NULL)
+		list->head->lruPrev = entry;
+	list->head = entry;
+	if(list->tail == NULL)
+		list->tail = entry;
+}
+
+/*
+ * Drops a reference to an entry and frees it (closing its fd) once the
+ * last one is gone.
+ */
+void _res_cache_unref(struct _res_cache_entry* entry)
+{
+	if(--entry->refs > 0)
+		return;
+
+	if(entry->fd >= 0)
+		close(entry->fd);
+	free(entry->path);
+	free(entry->filePath);
+	free(entry->data);
+	free(entry->header);
+	free(entry);
+}
+
+/*
+ * FNV-1a hash of a request path.
+ */
+unsigned int _res_hash(const char* path)
+{
+	unsigned int hash = 2166136261u;
+	while(*path != '\0')
+	{
+		hash ^= (unsigned char) *path++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * Like _res_file_accessable(), but for the request path 'filePath'. If the
+ * file index is used, the status is taken from there without a system call;
+ * only size, mode, mtime, dev and ino of 's' are filled in then.
+ */
+int _res_stat(const char* filePath, struct stat* s)
+{
+	if(_res_index_table == NULL)
+	{
+		char realPath[PATH_MAX];
+		if(_res_get_real_path(filePath, realPath, sizeof(realPath)) == FALSE)
+			return RES_FILE_NOT_FOUND;
+		return _res_file_accessable(realPath, s);
+	}
+
+	struct _res_index_entry* entry = _res_index_find(filePath);
+	if(entry == NULL)
+		return RES_FILE_NOT_FOUND;
+
+	s->st_size = entry->size;
+	s->st_mode = entry->mode;
+	s->st_mtime = entry->mtime;
+	s->st_dev = entry->dev;
+	s->st_ino = entry->ino;
+	return entry->access;
+}
+
+/*
+ * Checks for existance of a file and whether it is readable.
+ * Checks that it actually is a file, too. The file's status is written to 's'.
+ * Returns RES_OK on success, RES_FILE_NOT_FOUND or RES_ACCESS_DENIED else.
+ */
+int _res_file_accessable(const char* path, struct stat* s)
+{
+	if(stat(path, s) != 0)
+		return RES_FILE_NOT_FOUND;
+	else
+		return _res_file_access(s);
+}
+
+/*
+ * Returns RES_OK if the file with the status 's' is a file and readable,
+ * RES_ACCESS_DENIED else.
+ */
+int _res_file_access(const struct stat* s)
+{
+	if((s->st_mode & S_IFREG) &&
+		(_res_sufficient_rights(s->st_mode, s->st_uid, s->st_gid) == TRUE))
+		return RES_OK;
+	else
+		return RES_ACCESS_DENIED;
 }
 
 /*
@@ -173,65 +1087,472 @@ BOOL _res_sufficient_rights(const mode_t mode, const uid_t uid, const gid_t gid)
 }
 
 /*
- * Checks whether 'file' has a known file extension and translates that
- * into a mime type, which is written into resinfo->mime.
- * Returns TRUE, if it was a known file.
+ * Builds the real path of a relative path in 'buf' of 'size' bytes. Returns
+ * FALSE if it does not fit.
  */
-BOOL _res_known_file_type(const char* file, struct res_resource* resinfo)
+BOOL _res_get_real_path(const char* relPath, char* buf, size_t size)
 {
-	int extPos = strlen(file) - 3;
+	// Remove leading slash if necessary
+	if(relPath[0] == '/')
+		++relPath;
 
-	// Sanity check: File must not only be '.ext'
-	if(extPos <= 0)
+	size_t relPathLen = strlen(relPath);
+	if(_res_www_path_len + relPathLen >= size)
 		return FALSE;
 
-	const char* ext = &file[extPos];
+	memcpy(buf, _res_www_path, _res_www_path_len);
+	memcpy(&buf[_res_www_path_len], relPath, relPathLen + 1);
+	return TRUE;
+}
+
+
+/*
+ * Returns the concatenation of 'dir' (empty or ending with a slash), 'name'
+ * and 'suffix', which has to be free'd after use, or NULL if out of memory.
+ */
+char* _res_join(const char* dir, const char* name, const char* suffix)
+{
+	size_t dirLen = strlen(dir);
+	size_t nameLen = strlen(name);
+	char* ret = malloc(dirLen + nameLen + strlen(suffix) + 1);
+	if(ret == NULL)
+		return NULL;
+
+	memcpy(ret, dir, dirLen);
+	memcpy(&ret[dirLen], name, nameLen);
+	strcpy(&ret[dirLen + nameLen], suffix);
+	return ret;
+}
+
+/*
+ * (Re-)builds the file index from scratch by walking the www tree, putting
+ * a watch on every directory before reading it, so no change can slip
+ * through. Returns FALSE if the tree could not be indexed completely.
+ */
+BOOL _res_index_rebuild(void)
+{
+	_res_index_clear();
 
-	// Check for HTML file (only 'tml')
-	if(strcmp(ext, "tml") == 0)
+	if(_res_index_table == NULL)
 	{
-		strcpy(resinfo->mime, "text/html");
-		return TRUE;
+		_res_index_table = calloc(RES_INDEX_INITIAL_BUCKETS, sizeof(struct _res_index_entry*));
+		if(_res_index_table == NULL)
+			return FALSE;
+		_res_index_buckets = RES_INDEX_INITIAL_BUCKETS;
+	}
+
+	// The root is indexed like any directory (so requests for it are denied)
+	return _res_index_refresh("");
+}
+
+/*
+ * Empties the file index and removes all watches.
+ */
+void _res_index_clear(void)
+{
+	unsigned int i;
+	for(i = 0; i < _res_index_buckets; ++i)
+	{
+		while(_res_index_table[i] != NULL)
+		{
+			struct _res_index_entry* entry = _res_index_table[i];
+			_res_index_table[i] = entry->next;
+			free(entry->path);
+			free(entry);
+		}
 	}
-	else if(strcmp(ext, "jpg") == 0)
+	_res_index_count = 0;
+
+	int wd;
+	for(wd = 0; wd < _res_watch_capacity; ++wd)
+	{
+		if(_res_watch_dirs[wd] != NULL)
+		{
+			inotify_rm_watch(_res_index_fd, wd);
+			_res_watch_remove(wd);
+		}
+	}
+}
+
+/*
+ * Stops using the file index, so files are looked up in the file system
+ * again. The inotify fd stays open (without watches), as it may still be
+ * registered with the event loop.
+ */
+void _res_index_disable(void)
+{
+	if(_res_index_table != NULL)
 	{
-		strcpy(resinfo->mime, "image/jpeg");
+		_res_index_clear();
+		free(_res_index_table);
+		_res_index_table = NULL;
+		_res_index_buckets = 0;
+	}
+
+	free(_res_watch_dirs);
+	_res_watch_dirs = NULL;
+	_res_watch_capacity = 0;
+
+	// Cached entries have been validated against the index only
+	time_t now = time(NULL);
+	struct _res_cache_entry* entry;
+	for(entry = _res_mem_lru.head; entry != NULL; entry = entry->lruNext)
+		entry->validated = now - RES_CACHE_REVALIDATE_INTERVAL;
+	for(entry = _res_fd_lru.head; entry != NULL; entry = entry->lruNext)
+		entry->validated = now - RES_CACHE_REVALIDATE_INTERVAL;
+}
+
+/*
+ * Watches the directory 'relDir' (empty or ending with a slash) and indexes
+ * its contents, recursively. Returns FALSE if that failed for another reason
+ * than the directory being gone or unreadable.
+ */
+BOOL _res_index_dir(const char* relDir)
+{
+	// Too deep to be served anyway
+	char realDir[PATH_MAX];
+	if(_res_get_real_path(relDir, realDir, sizeof(realDir)) == FALSE)
+		return TRUE;
+
+	int wd = inotify_add_watch(_res_index_fd, realDir, RES_INDEX_EVENTS);
+	if(wd < 0)
+		return (errno == ENOENT) || (errno == ENOTDIR) || (errno == EACCES);
+
+	// A directory reached through a link may be indexed under another path
+	// already (or be one of its parents). A watch reports to one path only,
+	// so it is indexed there alone, which also ends link loops.
+	if((wd < _res_watch_capacity) && (_res_watch_dirs[wd] != NULL) &&
+		(strcmp(_res_watch_dirs[wd], relDir) != 0))
+		return TRUE;
+	if(_res_watch_add(wd, relDir) == FALSE)
+		return FALSE;
+
+	DIR* dir = opendir(realDir);
+	if(dir == NULL)
 		return TRUE;
+
+	BOOL ok = TRUE;
+	struct dirent* dirEntry;
+	while((ok == TRUE) && ((dirEntry = readdir(dir)) != NULL))
+	{
+		if((strcmp(dirEntry->d_name, ".") == 0) || (strcmp(dirEntry->d_name, "..") == 0))
+			continue;
+
+		char* relPath = _res_join(relDir, dirEntry->d_name, "");
+		ok = (relPath != NULL) && (_res_index_refresh(relPath) == TRUE);
+		free(relPath);
 	}
-	else if(strcmp(ext, "gif") == 0)
+
+	closedir(dir);
+	return ok;
+}
+
+/*
+ * Brings the index entry of 'relPath' in line with the file system: adds,
+ * updates or removes it. New directories are indexed recursively; symbolic
+ * links are served and indexed like their target.
+ * Returns FALSE if out of memory or out of watches.
+ */
+BOOL _res_index_refresh(const char* relPath)
+{
+	unsigned int hash = _res_hash(relPath);
+	struct _res_index_entry* entry = _res_index_get(relPath, hash);
+
+	// The www path itself may well be a link. Paths too long to be
+	// opened count as gone.
+	char realPath[PATH_MAX];
+	struct stat s;
+	BOOL exists = (_res_get_real_path(relPath, realPath, sizeof(realPath)) == TRUE) &&
+			((((relPath[0] != '\0') ? lstat(realPath, &s) : stat(realPath, &s)) == 0));
+	if((exists == TRUE) && S_ISLNK(s.st_mode))
+		exists = (stat(realPath, &s) == 0);
+	BOOL isDir = (exists == TRUE) && S_ISDIR(s.st_mode);
+
+	if(exists == FALSE)
 	{
-		strcpy(resinfo->mime, "image/gif");
+		if(entry != NULL)
+			_res_index_remove(entry);
 		return TRUE;
 	}
-	else if(strcmp(ext, "png") == 0)
+
+	if(entry == NULL)
 	{
-		strcpy(resinfo->mime, "image/png");
+		entry = _res_index_add(relPath, hash);
+		if(entry == NULL)
+			return FALSE;
+	}
+	else if((entry->tree == TRUE) && ((isDir == FALSE) || (s.st_dev != entry->dev) || (s.st_ino != entry->ino)))
+	{
+		// The directory was replaced, or the link leads elsewhere now
+		_res_index_prune(relPath);
+		entry->tree = FALSE;
+	}
+
+	entry->access = _res_file_access(&s);
+	entry->size = s.st_size;
+	entry->mode = s.st_mode;
+	entry->mtime = s.st_mtime;
+	entry->dev = s.st_dev;
+	entry->ino = s.st_ino;
+
+	if((isDir == FALSE) || (entry->tree == TRUE))
 		return TRUE;
+
+	// A new directory (or one moved here)
+	entry->tree = TRUE;
+	char* relDir = _res_join(relPath, (relPath[0] != '\0') ? "/" : "", "");
+	if(relDir == NULL)
+		return FALSE;
+	BOOL ok = _res_index_dir(relDir);
+	free(relDir);
+	return ok;
+}
+
+/*
+ * Returns the index entry for the request path 'path', or NULL if there is
+ * no such file. Like the file system, this ignores repeated slashes and "."
+ * segments, and a trailing slash (or ".") only matches directories. Paths
+ * with ".." never get here (see res_lookup()).
+ */
+struct _res_index_entry* _res_index_find(const char* path)
+{
+	while(*path == '/')
+		++path;
+
+	size_t len = strlen(path);
+	if((len == 0) || ((path[len - 1] != '/') && (path[len - 1] != '.') &&
+		(strstr(path, "//") == NULL) && (strstr(path, "./") == NULL)))
+		return _res_index_get(path, _res_hash(path));
+
+	// Normalize the path, segment by segment. Longer ones cannot exist.
+	char key[PATH_MAX];
+	if(len >= sizeof(key))
+		return NULL;
+	size_t keyLen = 0;
+	size_t pos = 0;
+	BOOL dirOnly = FALSE;
+	while(pos < len)
+	{
+		size_t end = pos;
+		while((end < len) && (path[end] != '/'))
+			++end;
+
+		size_t segLen = end - pos;
+		dirOnly = (end < len) || ((segLen == 1) && (path[pos] == '.'));
+		if((segLen > 1) || ((segLen == 1) && (path[pos] != '.')))
+		{
+			if(keyLen > 0)
+				key[keyLen++] = '/';
+			memcpy(&key[keyLen], &path[pos], segLen);
+			keyLen += segLen;
+		}
+		pos = end + 1;
 	}
+	key[keyLen] = '\0';
 
-	return FALSE;
+	struct _res_index_entry* entry = _res_index_get(key, _res_hash(key));
+
+	if((entry != NULL) && (dirOnly == TRUE) && !S_ISDIR(entry->mode))
+		return NULL;
+	return entry;
 }
 
 /*
- * Builds the real path of a relative path. Has to be free'd after use.
+ * Returns the index entry with the (normalized) path 'relPath', or NULL.
  */
-char *_res_get_real_path(const char* relPath)
+struct _res_index_entry* _res_index_get(const char* relPath, unsigned int hash)
 {
-	int relPathLen = strlen(relPath);
-	char* ret = malloc(_res_www_path_len + relPathLen);
+	struct _res_index_entry* entry = _res_index_table[hash & (_res_index_buckets - 1)];
+	while(entry != NULL)
+	{
+		if((entry->hash == hash) && (strcmp(entry->path, relPath) == 0))
+			return entry;
+		entry = entry->next;
+	}
+	return NULL;
+}
 
-	strcpy(ret, _res_www_path);
+/*
+ * Adds an empty entry for 'relPath' to the index. Returns NULL if out of
+ * memory.
+ */
+struct _res_index_entry* _res_index_add(const char* relPath, unsigned int hash)
+{
+	// Keep the chains short
+	if((_res_index_count >= _res_index_buckets) && (_res_index_grow() == FALSE))
+		return NULL;
 
-	// Remove leading slash if necessary
-	if(relPath[0] == '/')
+	struct _res_index_entry* entry = malloc(sizeof(struct _res_index_entry));
+	if(entry == NULL)
+		return NULL;
+	memset(entry, 0, sizeof(struct _res_index_entry));
+
+	entry->path = malloc(strlen(relPath) + 1);
+	if(entry->path == NULL)
 	{
-		strcat(ret, &relPath[1]);
+		free(entry);
+		return NULL;
 	}
-	else
+	strcpy(entry->path, relPath);
+	entry->hash = hash;
+
+	unsigned int bucket = hash & (_res_index_buckets - 1);
+	entry->next = _res_index_table[bucket];
+	_res_index_table[bucket] = entry;
+	++_res_index_count;
+	return entry;
+}
+
+/*
+ * Brings the index entry of the directory watched by 'wd' in line with the
+ * file system, like _res_index_refresh().
+ */
+BOOL _res_index_refresh_dir(int wd)
+{
+	// Watched directories end with a slash, except the root
+	const char* relDir = _res_watch_dirs[wd];
+	size_t len = strlen(relDir);
+	char* relPath = malloc(len + 1);
+	if(relPath == NULL)
+		return FALSE;
+	strcpy(relPath, relDir);
+	if(len > 0)
+		relPath[len - 1] = '\0';
+
+	BOOL ok = _res_index_refresh(relPath);
+	free(relPath);
+	return ok;
+}
+
+/*
+ * Removes an entry from the index, along with everything below it if it
+ * is a directory.
+ */
+void _res_index_remove(struct _res_index_entry* entry)
+{
+	if(entry->tree == TRUE)
+		_res_index_prune(entry->path);
+
+	struct _res_index_entry** link = &_res_index_table[entry->hash & (_res_index_buckets - 1)];
+	while(*link != entry)
+		link = &(*link)->next;
+	*link = entry->next;
+	--_res_index_count;
+
+	free(entry->path);
+	free(entry);
+}
+
+/*
+ * Removes everything below the directory 'relDir' (without trailing slash,
+ * empty for the root) from the index and stops watching it. Walks the
+ * whole index, which is fine as directories rarely go away.
+ */
+void _res_index_prune(const char* relDir)
+{
+	size_t len = strlen(relDir);
+
+	unsigned int i;
+	for(i = 0; i < _res_index_buckets; ++i)
 	{
-		strcat(ret, relPath);
+		struct _res_index_entry** link = &_res_index_table[i];
+		while(*link != NULL)
+		{
+			struct _res_index_entry* entry = *link;
+			if((len == 0) ? (entry->path[0] != '\0') :
+				((strncmp(entry->path, relDir, len) == 0) && (entry->path[len] == '/')))
+			{
+				*link = entry->next;
+				--_res_index_count;
+				free(entry->path);
+				free(entry);
+			}
+			else
+			{
+				link = &entry->next;
+			}
+		}
 	}
 
-	return ret;
+	// The watches of directories moved elsewhere would live on
+	int wd;
+	for(wd = 0; wd < _res_watch_capacity; ++wd)
+	{
+		const char* dir = _res_watch_dirs[wd];
+		if((dir != NULL) && ((len == 0) ||
+			((strncmp(dir, relDir, len) == 0) && (dir[len] == '/'))))
+		{
+			inotify_rm_watch(_res_index_fd, wd);
+			_res_watch_remove(wd);
+		}
+	}
+}
+
+/*
+ * Doubles the number of buckets of the index. Returns FALSE if out of memory.
+ */
+BOOL _res_index_grow(void)
+{
+	unsigned int buckets = _res_index_buckets * 2;
+	struct _res_index_entry** table = calloc(buckets, sizeof(struct _res_index_entry*));
+	if(table == NULL)
+		return FALSE;
+
+	unsigned int i;
+	for(i = 0; i < _res_index_buckets; ++i)
+	{
+		while(_res_index_table[i] != NULL)
+		{
+			struct _res_index_entry* entry = _res_index_table[i];
+			_res_index_table[i] = entry->next;
+			entry->next = table[entry->hash & (buckets - 1)];
+			table[entry->hash & (buckets - 1)] = entry;
+		}
+	}
+
+	free(_res_index_table);
+	_res_index_table = table;
+	_res_index_buckets = buckets;
+	return TRUE;
+}
+
+/*
+ * Remembers which directory the watch descriptor 'wd' watches. Returns FALSE
+ * if out of memory.
+ */
+BOOL _res_watch_add(int wd, const char* relDir)
+{
+	if(wd >= _res_watch_capacity)
+	{
+		int capacity = (_res_watch_capacity > 0) ? _res_watch_capacity : 64;
+		while(capacity <= wd)
+			capacity *= 2;
+
+		char** dirs = realloc(_res_watch_dirs, capacity * sizeof(char*));
+		if(dirs == NULL)
+			return FALSE;
+		memset(&dirs[_res_watch_capacity], 0, (capacity - _res_watch_capacity) * sizeof(char*));
+		_res_watch_dirs = dirs;
+		_res_watch_capacity = capacity;
+	}
+
+	// Watching the same directory again yields the same descriptor
+	free(_res_watch_dirs[wd]);
+	_res_watch_dirs[wd] = malloc(strlen(relDir) + 1);
+	if(_res_watch_dirs[wd] == NULL)
+		return FALSE;
+	strcpy(_res_watch_dirs[wd], relDir);
+	return TRUE;
 }
 
+/*
+ * Forgets the watch descriptor 'wd'.
+ */
+void _res_watch_remove(int wd)
+{
+	if((wd >= 0) && (wd < _res_watch_capacity))
+	{
+		free(_res_watch_dirs[wd]);
+		_res_watch_dirs[wd] = NULL;
+	}
+}
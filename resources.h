@@ -9,7 +9,11 @@
 #ifndef RESOURCES_H_
 #define RESOURCES_H_
 
-#include <stdio.h> // for FILE
+#include "base.h"
+
+#include <stddef.h> // for size_t
+#include <sys/types.h> // for off_t
+#include <time.h> // for time_t
 
 /**************************** Module types & constants ***********************/
 
@@ -19,9 +23,18 @@
  */
 struct res_resource
 {
-	FILE* file;	/* file pointer, already opened */
-	char mime[15]; /* mime type */
-	int len; /* file size in bytes */
+	int fd;	/* file descriptor opened for reading (shared, do not close), or -1 */
+	const char* data; /* file contents if held in memory, or NULL */
+	const char* mime; /* mime type (owned by the mime type registry) */
+	off_t len; /* file size in bytes */
+	const char* header; /* serialized entity headers (Content-Length etc.), CRLF-terminated */
+	size_t headerLen;
+	size_t typeOff; /* the header from here on lacks the Content-Length line (for 206s) */
+	size_t validatorsOff; /* the header from here on (Vary, ETag, Last-Modified) is sent with 304s */
+	const char* etag; /* quoted entity tag (within 'header') */
+	size_t etagLen;
+	time_t mtime; /* last modification, as sent in Last-Modified */
+	void* cacheRef; /* reference to the cache entry holding 'data' or 'fd' */
 };
 
 /*
@@ -45,21 +58,87 @@ extern const int RES_IO_ERROR;
  */
 int res_set_www_path(char* path);
 
+/*
+ * Sets the memory budget of the content cache in bytes. Small files are kept
+ * in memory (up to this budget, least recently used files are evicted
+ * first); for larger files, a bounded number of open fds is cached. Cached
+ * files are checked for modification at most once per second. 0 disables
+ * caching file contents. Has to be called before the first lookup.
+ */
+void res_set_cache_size(size_t size);
+
+/*
+ * Enables compressing text files on their first request by a client which
+ * accepts gzip, if there is no precompressed 'file.gz' next to them. Only
+ * files small enough to be held in memory are compressed; the result is
+ * kept in the content cache. Off by default.
+ */
+void res_set_compression(BOOL enabled);
+
+/*
+ * Walks the www path and builds an index of the status of all files below it,
+ * which is kept current with inotify. From then on, lookups take existence,
+ * size, modification time and access rights from the index, so requests for
+ * files which do not exist are answered without any system call, and cached
+ * files are revalidated on every lookup instead of once per second at no
+ * cost. Symbolic links to directories are not followed.
+ * The index belongs to the calling process, so every worker has to build its
+ * own. Returns RES_OK, or RES_IO_ERROR if the tree could not be indexed (eg.
+ * because the inotify watch limit was hit); files are then looked up in the
+ * file system as without an index.
+ */
+int res_build_index(void);
+
+/*
+ * Returns the fd to watch for readability while the index is used, or -1.
+ * Whenever it becomes readable, res_update_index() has to be called.
+ */
+int res_get_index_fd(void);
+
+/*
+ * Applies the pending changes of the www tree to the index. Never blocks.
+ */
+void res_update_index(void);
+
 /*
  * Lookup method. Used to find 'path' in the filesystem. If the file is found, the
- * resource struct is filled appropriately and RES_OK is returned. The FILE contained
- * in the resource struct should be closed after using.
+ * resource struct is filled appropriately and RES_OK is returned. The content is
+ * either available in resinfo->data or has to be read from resinfo->fd. The fd may
+ * be shared with other resources, so it must be read with pread()/sendfile() at
+ * explicit offsets and must not be closed. In both cases, res_release() has to be
+ * called after using.
+ * If 'acceptGzip' is TRUE and a gzip variant of the file exists (or compression
+ * is enabled), the resource describes that variant instead; its header then
+ * contains "Content-Encoding: gzip".
  * Return values:
  * - RES_OK
  * - RES_FILE_NOT_FOUND : 'path' does not exist in the file system
  * - RES_INVALID_PATH : 'path' contained '..'
  * - RES_ACCESS_DENIED : 'path' is not a regular file or could not be accessed
- * - RES_UNKNOWN_FILE_TYPE : 'path' is neither a HTML file nor a GIF/JPEG image
+ * - RES_UNKNOWN_FILE_TYPE : 'path' has no extension known to the mime type registry
  * - RES_IO_ERROR : 'path' could not be opened for reading.
  *
  * Neither path not resinfo may be NULL.
  */
-int res_lookup(const char* path, struct res_resource* resinfo);
+int res_lookup(const char* path, BOOL acceptGzip, struct res_resource* resinfo);
+
+/*
+ * The header bytes of a resource live as long as its cache entry, i.e. until
+ * res_release() or res_release_ref() is called.
+ */
+
+/*
+ * Releases a resource returned by res_lookup(): closes its fd or drops its
+ * reference to the cache entry.
+ */
+void res_release(struct res_resource* resinfo);
+
+/*
+ * Drops a reference to a cache entry (resinfo->cacheRef). This allows to
+ * keep resinfo->data or resinfo->fd alive without keeping the resource
+ * struct around.
+ */
+void res_release_ref(void* cacheRef);
 
 /*
  * Clean-up method. Has to be called when the server exits.
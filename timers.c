@@ -0,0 +1,212 @@
+/*
+ * timers.c
+ *
+ * This file contains the module 'timers', a hierarchical timer wheel (see
+ * timers.h). Time is counted in ticks of TMR_RESOLUTION milliseconds; with
+ * four levels of 64 slots, timers may lie up to 64^4 ticks (about 19 days)
+ * ahead, later ones are moved closer.
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#include "base.h"
+#include "timers.h"
+
+#include <stddef.h>
+
+#include <time.h>
+
+/**************************** Local constants ********************************/
+
+/* milliseconds per tick */
+#define TMR_RESOLUTION 100
+
+/* index of a slot within its level */
+#define TMR_SLOT_MASK (TMR_SLOTS - 1)
+
+/* the farthest a timer may lie ahead, in ticks */
+#define TMR_MAX_TICKS ((1ULL << (TMR_SLOT_BITS * TMR_LEVELS)) - 1)
+
+/**************************** Prototypes *************************************/
+
+void _tmr_insert(struct tmr_wheel* wheel, struct tmr_timer* timer);
+void _tmr_cascade(struct tmr_wheel* wheel, int level);
+void _tmr_link(struct tmr_timer* head, struct tmr_timer* timer);
+void _tmr_unlink(struct tmr_timer* timer);
+
+/**************************** Module interface *******************************/
+
+uint64_t tmr_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void tmr_init(struct tmr_wheel* wheel, uint64_t now)
+{
+	wheel->now = now / TMR_RESOLUTION;
+	wheel->count = 0;
+
+	int level, slot;
+	for(level = 0; level < TMR_LEVELS; ++level)
+	{
+		for(slot = 0; slot < TMR_SLOTS; ++slot)
+		{
+			wheel->slots[level][slot].next = &wheel->slots[level][slot];
+			wheel->slots[level][slot].prev = &wheel->slots[level][slot];
+		}
+	}
+	wheel->expired.next = &wheel->expired;
+	wheel->expired.prev = &wheel->expired;
+}
+
+void tmr_schedule(struct tmr_wheel* wheel, struct tmr_timer* timer, uint64_t expires)
+{
+	tmr_cancel(wheel, timer);
+
+	// Round up to the next tick
+	timer->expires = (expires + TMR_RESOLUTION - 1) / TMR_RESOLUTION;
+	if((timer->expires > wheel->now) && (timer->expires - wheel->now > TMR_MAX_TICKS))
+		timer->expires = wheel->now + TMR_MAX_TICKS;
+
+	_tmr_insert(wheel, timer);
+	++wheel->count;
+}
+
+void tmr_cancel(struct tmr_wheel* wheel, struct tmr_timer* timer)
+{
+	if(timer->next == NULL)
+		return;
+
+	_tmr_unlink(timer);
+	--wheel->count;
+}
+
+struct tmr_timer* tmr_expire(struct tmr_wheel* wheel, uint64_t now)
+{
+	uint64_t target = now / TMR_RESOLUTION;
+
+	while((wheel->expired.next == &wheel->expired) && (wheel->now < target))
+	{
+		// Nothing to turn past
+		if(wheel->count == 0)
+		{
+			wheel->now = target;
+			break;
+		}
+
+		++wheel->now;
+
+		// Whenever a level has come full circle, move the timers of the
+		// next slot of the level above down
+		int level;
+		for(level = 1; level < TMR_LEVELS; ++level)
+		{
+			if((wheel->now & ((1ULL << (TMR_SLOT_BITS * level)) - 1)) != 0)
+				break;
+			_tmr_cascade(wheel, level);
+		}
+
+		// The timers of the current slot of the lowest level have expired
+		struct tmr_timer* head = &wheel->slots[0][wheel->now & TMR_SLOT_MASK];
+		while(head->next != head)
+		{
+			struct tmr_timer* timer = head->next;
+			_tmr_unlink(timer);
+			_tmr_link(&wheel->expired, timer);
+		}
+	}
+
+	if(wheel->expired.next == &wheel->expired)
+		return NULL;
+
+	struct tmr_timer* timer = wheel->expired.next;
+	_tmr_unlink(timer);
+	--wheel->count;
+	return timer;
+}
+
+int tmr_next_timeout(const struct tmr_wheel* wheel, uint64_t now)
+{
+	if(wheel->count == 0)
+		return -1;
+	if(wheel->expired.next != &wheel->expired)
+		return 0;
+
+	// Find the next slot of the lowest level which is not empty. Timers of
+	// the higher levels are not found there before the level comes full
+	// circle, so the wheel has to be turned then at the latest.
+	uint64_t tick = wheel->now + 1;
+	while((tick & TMR_SLOT_MASK) != 0)
+	{
+		const struct tmr_timer* head = &wheel->slots[0][tick & TMR_SLOT_MASK];
+		if(head->next != head)
+			break;
+		++tick;
+	}
+
+	uint64_t at = tick * TMR_RESOLUTION;
+	return (at > now) ? (int) (at - now) : 0;
+}
+
+/**************************** Local methods **********************************/
+
+/*
+ * Links a timer into the slot of the lowest level which reaches its expiry
+ * tick, or into the expired list if that has passed.
+ */
+void _tmr_insert(struct tmr_wheel* wheel, struct tmr_timer* timer)
+{
+	if(timer->expires <= wheel->now)
+	{
+		_tmr_link(&wheel->expired, timer);
+		return;
+	}
+
+	uint64_t delta = timer->expires - wheel->now;
+	int level = 0;
+	while((level < TMR_LEVELS - 1) && (delta >> (TMR_SLOT_BITS * (level + 1)) != 0))
+		++level;
+
+	int slot = (timer->expires >> (TMR_SLOT_BITS * level)) & TMR_SLOT_MASK;
+	_tmr_link(&wheel->slots[level][slot], timer);
+}
+
+/*
+ * Moves the timers of the current slot of 'level' into the levels below.
+ */
+void _tmr_cascade(struct tmr_wheel* wheel, int level)
+{
+	struct tmr_timer* head = &wheel->slots[level][(wheel->now >> (TMR_SLOT_BITS * level)) & TMR_SLOT_MASK];
+	while(head->next != head)
+	{
+		struct tmr_timer* timer = head->next;
+		_tmr_unlink(timer);
+		_tmr_insert(wheel, timer);
+	}
+}
+
+/*
+ * Appends a timer to the list 'head'.
+ */
+void _tmr_link(struct tmr_timer* head, struct tmr_timer* timer)
+{
+	timer->next = head;
+	timer->prev = head->prev;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+/*
+ * Removes a timer from its list.
+ */
+void _tmr_unlink(struct tmr_timer* timer)
+{
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+}
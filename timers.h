@@ -0,0 +1,87 @@
+/*
+ * timers.h
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#ifndef TIMERS_H_
+#define TIMERS_H_
+
+#include "base.h"
+
+#include <stdint.h> // for uint64_t
+
+/**************************** Module types & constants ***********************/
+
+/*
+ * A timer, to be embedded into the struct it belongs to. A zeroed timer is
+ * not scheduled.
+ */
+struct tmr_timer
+{
+	struct tmr_timer* next; /* neighbours in the list it is in, NULL if not scheduled */
+	struct tmr_timer* prev;
+	uint64_t expires; /* tick it expires at (internal) */
+};
+
+/* levels of the wheel, and slots per level */
+#define TMR_LEVELS 4
+#define TMR_SLOT_BITS 6
+#define TMR_SLOTS (1 << TMR_SLOT_BITS)
+
+/*
+ * A hierarchical timer wheel. Each level has TMR_SLOTS slots and each slot
+ * of a level spans all slots of the level below. Timers are kept in the
+ * slot of the lowest level which reaches their expiry; when the wheel turns
+ * past a slot of a higher level, its timers move down. Scheduling and
+ * cancelling a timer take constant time.
+ */
+struct tmr_wheel
+{
+	uint64_t now; /* the current tick; timers up to it have expired */
+	unsigned int count; /* number of timers scheduled */
+	struct tmr_timer slots[TMR_LEVELS][TMR_SLOTS]; /* list heads */
+	struct tmr_timer expired; /* timers expired but not yet returned */
+};
+
+/**************************** Module interface *******************************/
+
+/*
+ * Returns a monotonic timestamp in milliseconds, the time base of all
+ * timers.
+ */
+uint64_t tmr_now(void);
+
+/*
+ * Initializes an empty wheel, starting at the time 'now'.
+ */
+void tmr_init(struct tmr_wheel* wheel, uint64_t now);
+
+/*
+ * (Re-)Schedules 'timer' to expire at the time 'expires', see tmr_now().
+ * Timers expire on the first tick (of 100 ms) not before that time.
+ */
+void tmr_schedule(struct tmr_wheel* wheel, struct tmr_timer* timer, uint64_t expires);
+
+/*
+ * Cancels 'timer' if it is scheduled.
+ */
+void tmr_cancel(struct tmr_wheel* wheel, struct tmr_timer* timer);
+
+/*
+ * Turns the wheel forward to the time 'now' and returns the next timer
+ * which has expired, which is then no longer scheduled, or NULL if there
+ * is none. Has to be called until it returns NULL.
+ */
+struct tmr_timer* tmr_expire(struct tmr_wheel* wheel, uint64_t now);
+
+/*
+ * Returns the milliseconds from 'now' until the wheel has to be turned
+ * next (at the latest when the next timer expires), or -1 if no timer is
+ * scheduled.
+ */
+int tmr_next_timeout(const struct tmr_wheel* wheel, uint64_t now);
+
+#endif /* TIMERS_H_ */
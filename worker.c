@@ -0,0 +1,141 @@
+/*
+ * worker.c
+ *
+ * This file contains the module 'worker'. It forks a number of identical
+ * worker processes, each of which runs its own event loop on its own
+ * SO_REUSEPORT listening socket, so the kernel spreads new connections
+ * over all workers and they share no state on the hot path.
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#define _GNU_SOURCE // for sched_setaffinity
+
+#include "worker.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**************************** Prototypes *************************************/
+
+void _wrk_pin_to_cpu(int index);
+
+/**************************** Global constants *******************************/
+
+const int WRK_MASTER = -1;
+const int WRK_ERROR = -2;
+
+/**************************** Local variables ********************************/
+
+/* pids of the workers, only set in the master */
+pid_t* _wrk_pids = NULL;
+int _wrk_num_workers = 0;
+
+/**************************** Module interface *******************************/
+
+int wrk_start(int numWorkers, BOOL pinCpus)
+{
+	if(numWorkers <= 1)
+	{
+		if(pinCpus == TRUE)
+			_wrk_pin_to_cpu(0);
+		return 0;
+	}
+
+	_wrk_pids = malloc(sizeof(pid_t) * numWorkers);
+	if(_wrk_pids == NULL)
+	{
+		fprintf(stderr, "Error: Out of memory.\n");
+		return WRK_ERROR;
+	}
+
+	int i;
+	for(i = 0; i < numWorkers; ++i)
+	{
+		pid_t pid = fork();
+		if(pid < 0)
+		{
+			fprintf(stderr, "Error: Could not start worker %i.\n", i);
+			break;
+		}
+		else if(pid == 0)
+		{
+			// Worker process
+			free(_wrk_pids);
+			_wrk_pids = NULL;
+			_wrk_num_workers = 0;
+
+			if(pinCpus == TRUE)
+				_wrk_pin_to_cpu(i);
+			return i;
+		}
+
+		_wrk_pids[i] = pid;
+		_wrk_num_workers = i + 1;
+	}
+
+	return (_wrk_num_workers > 0) ? WRK_MASTER : WRK_ERROR;
+}
+
+int wrk_wait(void)
+{
+	int ret = 0;
+	int running = _wrk_num_workers;
+
+	while(running > 0)
+	{
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if(pid < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+
+		if(!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+			ret = 1;
+		--running;
+	}
+
+	free(_wrk_pids);
+	_wrk_pids = NULL;
+	_wrk_num_workers = 0;
+
+	return ret;
+}
+
+void wrk_stop(void)
+{
+	int i;
+	for(i = 0; i < _wrk_num_workers; ++i)
+		kill(_wrk_pids[i], SIGINT);
+}
+
+/**************************** Local methods **********************************/
+
+/*
+ * Pins the calling process to CPU 'index' modulo the number of CPUs.
+ * Failure is not fatal.
+ */
+void _wrk_pin_to_cpu(int index)
+{
+	long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if(numCpus < 1)
+		numCpus = 1;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(index % numCpus, &set);
+
+	if(sched_setaffinity(0, sizeof(cpu_set_t), &set) != 0)
+		fprintf(stderr, "Warning: Could not pin worker %i to a CPU.\n", index);
+}
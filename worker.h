@@ -0,0 +1,48 @@
+/*
+ * worker.h
+ *
+ *  Created on: 09.01.2010
+ *  	Author: Johannes Greiner <johannes.greiner@inf.fu-berlin.de>
+ *      Author: Malte Rohde <malte.rohde@inf.fu-berlin.de>
+ */
+
+#ifndef WORKER_H_
+#define WORKER_H_
+
+#include "base.h"
+
+/**************************** Module types & constants ***********************/
+
+/*
+ * returned by wrk_start() in the master process
+ */
+extern const int WRK_MASTER;
+extern const int WRK_ERROR;
+
+/**************************** Module interface *******************************/
+
+/*
+ * Starts 'numWorkers' worker processes. Each worker is expected to open its
+ * own listening socket (SO_REUSEPORT) and run its own main loop. If
+ * 'pinCpus' is TRUE, worker i is pinned to CPU i (modulo the number of
+ * CPUs).
+ * Returns the index of the worker (0..numWorkers-1) in the worker processes,
+ * WRK_MASTER in the master process or WRK_ERROR if no worker could be
+ * started. If numWorkers is 1 or less, no process is forked and 0 is
+ * returned, so the caller simply runs as the only worker.
+ */
+int wrk_start(int numWorkers, BOOL pinCpus);
+
+/*
+ * Waits until all workers have exited. Must only be called by the master.
+ * Returns 0 if all workers exited successfully, 1 else.
+ */
+int wrk_wait(void);
+
+/*
+ * Asks all workers to stop. May be called from a signal handler; does
+ * nothing in a worker process.
+ */
+void wrk_stop(void);
+
+#endif /* WORKER_H_ */